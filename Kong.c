@@ -1,14 +1,40 @@
+#ifdef KONG_HEADLESS
+#include "headless.h"
+#else
 #include <conf.h>
 #include <kernel.h>
 #include <io.h>
 #include <bios.h>
+#endif
 #include <time.h>
 
 #include "maps.h"
 
 #define RAND_2(MAX, MIN) (rand() % (MAX - MIN)) + MIN
 
-#define TICKS_IN_A_SECOND 18
+// The PIT (channel 0) runs this many times faster than the 18.2 Hz of the BIOS, 4 = ~73 Hz
+// the game gets a finer tick, clkint divides it back so XINU and the BIOS still get their 18.2 Hz
+// (up to 8, so the longest times of a level still fit in an int)
+#define CLOCK_DIVISOR 4
+#if CLOCK_DIVISOR < 1 || CLOCK_DIVISOR > 8
+#error CLOCK_DIVISOR has to be between 1 and 8
+#endif
+// Turns a time in BIOS ticks (18.2 Hz) to game ticks, the times of the game are written in BIOS ticks
+#define TICKS(T) ((T) * CLOCK_DIVISOR)
+#define TICKS_IN_A_SECOND TICKS(18)
+// 1 = the PIT is set in one shot to the next deadline (the next thing the game has to do, a key wakes it up right away)
+// 0 = the PIT interrupts every tick
+#define TICKLESS_CLOCK 1
+// The BIOS counts 0x1800B0 ticks in a day
+#define BIOS_TICKS_IN_A_DAY 0x1800B0L
+// The clocks of the game (elapsed_time, game_time and the times taken from them) are unsigned and wrap around
+// (at ~73 Hz a 16 bit clock wraps every 15 minutes), so two times are compared only by the ticks between them
+#define TICKS_BETWEEN(FROM, TO) ((int) ((TO) - (FROM)))
+// Did the clock get to the time ?
+#define TIME_REACHED(NOW, TIME) (TICKS_BETWEEN(TIME, NOW) >= 0)
+// The most steps the simulation runs in a frame to catch up with the time
+// if it's behind more than that, the rest of the ticks are dropped (the game slows down instead of jumping)
+#define MAX_CATCH_UP_STEPS TICKS(4)
 #define CYCLE_UPDATER 0
 #define CYCLE_MANAGER 0
 #define CYCLE_DRAWER 0
@@ -27,6 +53,9 @@
 #define KEY_SPACE 57
 #define KEY_ENTER 28
 #define KEY_ESC 1
+#define KEY_R 19
+// The ascii code of CTRL+R
+#define ASCII_CTRL_R 18
 
 #define SOUND_PLAY_DELAY 1
 #define SOUND_BARREL_HIT_FREQ 87
@@ -36,29 +65,124 @@
 #define SOUND_GAME_OVER_FREQ 18
 #define SOUND_GAME_WON_FREQ 3951
 
+// The text mode screen memory has a few pages (at 0B800h), every page is 4KB
+// We print to the page that is not shown and then show it
+#define SCREEN_PAGES 2
+#define SCREEN_PAGE_SIZE 4096
+
+// How the printed page is shown
+// Immediate - right after it's printed
+// VSync - synced to the vertical retrace of the screen (read from port 3DAh)
+#define PRESENT_IMMEDIATE 0
+#define PRESENT_VSYNC 1
+// How many times we read the status port before giving up on the retrace
+// (so we dont hang if there is no retrace to wait for)
+#define RETRACE_WAIT_LIMIT 30000
+
+// Where the frames are printed to (see the render backends)
+// Build with KONG_HEADLESS defined to print them to memory instead of the screen
+// (that build leaves out XINU and the asm, so it builds and runs on a normal host, see headless.h)
+// the memory screen has a single page
+#define MEMORY_SCREEN_PAGES 1
+
+// The size of the frame history (in words), holds the changes of the last printed frames
+// A frame in the game changes around 100 words, so that's a few seconds of the game
+#define FRAME_HISTORY_WORDS 6144
+#define FRAME_HISTORY_VERSION 1
+#define FRAME_HISTORY_FILE_NAME "KONGHIST.BIN"
+// A frame where the whole screen changed (3 words + a span of every row) has to fit in the history
+#if FRAME_HISTORY_WORDS < 3 + SCREEN_HEIGHT * (2 + SCREEN_WIDTH)
+#error FRAME_HISTORY_WORDS is too small for a full frame
+#endif
+
+// The level pack, a file with levels that are played instead of the built in ones (see README)
+#define LEVEL_PACK_FILE_NAME "KONG.LVL"
+#define LEVEL_PACK_VERSION 1
+#define MAX_LEVELS 8
+// How much the levels of the level pack can have (all of them together)
+#define LEVEL_PACK_MAX_LADDERS 64
+#define LEVEL_PACK_MAX_HAMMER_PLATFORMS 32
+#define LEVEL_PACK_MAPS_BYTES 2048
+
+// A cell of the screen memory: the char in the low byte and the color in the high byte
+#define MAKE_CELL(pixel, color) ((((unsigned int) (unsigned char) (color)) << 8) | (unsigned char) (pixel))
+
 #define MAIN_MENU_COUNT 2
 #define GAME_OVER_COUNT 2
 #define MENU_MAX_STRINGS 4
 
 #define MAX_GAME_OBJECTS 64
 #define MAX_BARRELS_OBJECT MAX_GAME_OBJECTS - 1
+// The size of a barrel
+#define BARREL_WIDTH 2
+#define BARREL_HEIGHT 1
+// How many steps the path of a barrel can have (from kong until it leaves the screen)
+#define MAX_TRAJECTORY_STEPS 400
+// How many slots the index of the trajectory steps (by position) has (a power of 2)
+#define TRAJECTORY_INDEX_SLOTS 128
 #define MAX_SAVED_INPUT 4
-
-#define JUMP_DURATION_IN_TICKS 25
-#define HAMMER_DURATION_IN_TICKS 3
-
-#define GAME_OBJECT_LABEL_LENGTH 18
+// Every barrel + the player + the hammer + the HUD texts
+#define MAX_DRAWN_RECTS MAX_GAME_OBJECTS + 8
+// A bit for every frame of display_frames (used to know which frames still need to be drawn into)
+#define FRAME_BIT(index) (1 << (index))
+#define ALL_FRAMES_MASK 3
+
+#define HUD_WIDGETS_COUNT 8
+
+// The kinds of tiles of a level, every kind has it's own bits
+// Solid = the platforms (z/Z), Ladder = any cell of a ladder, Ladder rung = the middle of a ladder (_)
+#define TILE_SOLID 0
+#define TILE_LADDER 1
+#define TILE_LADDER_RUNG 2
+#define TILE_KINDS 3
+// How many words (16 cells) a row of tiles takes
+#define TILE_ROW_WORDS ((SCREEN_WIDTH + 15) / 16)
+
+// The timers of the game events (in the timer wheel)
+#define TIMER_GRAVITY 0
+#define TIMER_SPAWN_BARREL 1
+#define TIMER_SPAWN_FALLING_BARREL 2
+#define TIMERS_COUNT 3
+// How many slots the timer wheel has (a power of 2)
+#define TIMER_WHEEL_SLOTS 32
+
+// The biggest model is 3x3, with at most 2 runs in a row
+#define MAX_SPRITE_RUNS 6
+#define MAX_SPRITE_CELLS 9
+
+#define JUMP_DURATION_IN_TICKS TICKS(25)
+#define HAMMER_DURATION_IN_TICKS TICKS(3)
+
+// The flags of a game object
+// Active = the object is in the game, Climbs = moves on ladders,
+// Hurt by barrels = loses a life when a barrel hits it, In background = never moves, drawn in the background
+#define OBJECT_ACTIVE 1
+#define OBJECT_CLIMBS 2
+#define OBJECT_HURT_BY_BARRELS 4
+#define OBJECT_IN_BACKGROUND 8
+
+// The entities table: the game objects that are not barrels (the barrels are kept in their own arrays)
+#define ENTITY_PLAYER 0
+#define ENTITY_PRINCESS 1
+#define ENTITY_KONG 2
+#define ENTITY_HAMMER 3
+#define MAX_ENTITIES 4
 
 #define PLAYER_LIFE_COUNT 3
-#define PLAYER_START_POS_X 40
-#define PLAYER_START_POS_Y 20
 #define HAMMER_MAX_HITS 4
 
-#define FALLING_BARREL_SPAWN_IN_TICKS 18*4
-#define FALLING_BARREL_MAX_FALL 6*14
+#define FALLING_BARREL_SPAWN_IN_TICKS TICKS(18*4)
+#define FALLING_BARREL_MAX_FALL TICKS(6*14)
 
-#define MAX_POINTS 99999
-#define MIN_POINTS 0
+// The longest timing a level can have (in BIOS ticks, a minute)
+// the times of the game are set up to this (and a fall) ahead of game_time, it has to stay well inside the wrap-safe compare
+#define LEVEL_MAX_TIMING (60 * 18)
+#if TICKS(LEVEL_MAX_TIMING) + FALLING_BARREL_MAX_FALL > 16383
+#error LEVEL_MAX_TIMING is too long for CLOCK_DIVISOR
+#endif
+
+// The score is kept as digits, it's clamped to what fits in them (0 - 99999)
+#define SCORE_DIGITS 5
 #define POINTS_BARREL_HIT 100
 #define POINTS_GAME_WON 750
 #define POINTS_LEVEL_WON 500
@@ -76,6 +200,16 @@ typedef enum gameState{
     InGameWon = 3
 } GameState;
 
+// The kinds of game objects
+typedef enum objectKind{
+    KindPlayer = 0,
+    KindPrincess = 1,
+    KindKong = 2,
+    KindHammer = 3,
+    KindLadders = 4,
+    KindScreen = 5
+} ObjectKind;
+
 /* Structs */
 // Used to save the position of elements
 typedef struct Position{
@@ -83,11 +217,49 @@ typedef struct Position{
     int y;
 } position;
 
+// Used to save an area of the screen
+typedef struct Rect{
+    int x;
+    int y;
+    int width;
+    int height;
+} rect;
+
+// A run of opaque cells in a row of a sprite
+typedef struct SpriteRun{
+    // Where the run starts inside the model
+    int x;
+    int y;
+    // How many cells are in the run
+    int length;
+    // The index of the first cell of the run in the sprite cells
+    int first_cell;
+} spriteRun;
+
+// A model that is compiled to runs of char + color words
+// so drawing it is a few copies (the spaces in the model are transparent)
+typedef struct Sprite{
+    // The model the sprite is compiled from
+    char* model;
+    // The dimensions of the model
+    int width;
+    int height;
+    // The color of the sprite
+    char color_byte;
+
+    // The runs of the sprite
+    spriteRun runs[MAX_SPRITE_RUNS];
+    int runs_count;
+    // The cells of all the runs, one after the other
+    unsigned int cells[MAX_SPRITE_CELLS];
+} sprite;
+
 // Used to store information about game objects in the game
 typedef struct GameObject{
-    // The label of the game object
-    // Can be used to identified the object
-    char label[GAME_OBJECT_LABEL_LENGTH];
+    // What the game object is
+    ObjectKind kind;
+    // The flags of the game object (OBJECT_...)
+    int flags;
 
     // The top left point of the game object
     position top_left_point;
@@ -97,35 +269,78 @@ typedef struct GameObject{
     // The height of the game object
     int height;
 
-    // The model of the game object
-    char** model;
+    // The sprite of the game object
+    sprite* sprite;
 } gameObject;
 
-// Used to store info about the barrel
-typedef struct Barrel{
-    // The barrel game object
-    gameObject* obj;
-
-    // How many ticks to move
-    int movement_ticks;
-
-    // How many ticks to apply gravity
-    int gravity_ticks;
-
-    // Is the barrel grounded ?
+// A line of text that is drawn on top of the level (the clock, the score...)
+// It's drawn into a frame only when it's text changed since the frame got it
+typedef struct Widget{
+    // Where the widget starts
+    int x;
+    int y;
+    // How many chars the widget has
+    int length;
+    // The color of the widget
+    char color_byte;
+    // The text of the widget, a space shows the background under it
+    char* text;
+    // The frames that dont hold the text yet (FRAME_BIT of the frame)
+    int redraw_mask;
+    // The number the text shows (for number widgets, -1 = nothing)
+    int value;
+} widget;
+
+// A step of the path the barrels take from kong
+typedef struct TrajectoryStep{
+    // Where the barrel is
+    int x;
+    int y;
+    // Is the barrel on a platform ? (grounded = the next step is a roll, otherwise it's a fall)
     int is_grounded;
-
-    // The direction of the movement (1 = Right, -1 = Left)
+    // The direction the barrel rolls at this step
     int movement_direction;
-
-    // Is the barrel a falling down barrel ?
-    int is_falling_barrel;
-
-    // How mant ticks to fall
-    int falling_ticks;
-} barrel;
+} trajectoryStep;
+
+// How a level starts in the level pack (the fields of levelInfo that are not pointers)
+// It's followed by the ladders, the hammer platforms and the packed map of the level
+typedef struct LevelPackLevel{
+    int player_start_x;
+    int player_start_y;
+    int kong_x;
+    int kong_y;
+    int princess_x;
+    int princess_y;
+    int spawn_barrel_speed_in_ticks;
+    int spawn_falling_barrel_speed_in_ticks;
+    int barrel_movement_speed_in_ticks;
+    int apply_gravity_every_ticks;
+    int flags;
+    unsigned int ladders_count;
+    unsigned int hammer_platforms_count;
+    // How many bytes the packed map has
+    unsigned int map_bytes;
+} levelPackLevel;
+
+// Where the frames are printed to
+// The drawer talks to the screen only through this, so the frames can be printed somewhere else
+typedef struct RenderBackend{
+    // The name of the backend
+    char* name;
+    // How many pages the backend has (up to SCREEN_PAGES)
+    // with more than one the frame is printed to a page that is not shown and than it's shown
+    int pages_count;
+    // Copies count cells to the page, starting from first_cell
+    void (*print_cells)(int page, int first_cell, unsigned int* cells, int count);
+    // Shows the page
+    void (*show_page)(int page);
+    // Clears the first page and shows it
+    void (*clear)();
+} renderBackend;
 
 /* Time vars */
+// The time of the BIOS (in it's ticks) when the game clock was set
+long bios_start_ticks = 0;
 // Counting the ticks
 int clock_ticks = 0;
 // Counting the seconds
@@ -134,12 +349,25 @@ int clock_seconds = 0;
 int clock_minutes = 0;
 // Counter of deltaTimes so we can keep track of time
 int deltaTime_counter = 0;
-// Saves the last elapsed time the function was called
-int time_handler_last_call = 0;
 // A way to not lose any seconds
 int deltaSeconds = 0;
 // External counting of ticks that has passed (in the file clkint.c)
-extern int elapsed_time;
+extern unsigned int elapsed_time;
+// The clock divider of clkint (how many interrupts are one tick of XINU)
+extern int clock_divisor;
+extern int clock_divisor_count;
+// The ticks of XINU since the game clock was set
+extern long clock_base_ticks;
+// The tickless mode of clkint
+extern int clock_tickless;
+extern int clock_deadline_ticks;
+// Sets the next shot of the PIT / cuts the running shot when the deadline got closer (in clkint.c)
+extern void program_clock_shot();
+extern void rearm_clock_shot();
+// The ticks every process did not take yet (the counting mailbox of clkint)
+extern int pending_ticks[];
+// Ticks that could not be sent (for debug)
+extern long clock_ticks_dropped;
 
 /* Schedule vars */
 int sched_arr_pid[SCHED_ARR_LENGTH] = { -1 };
@@ -167,30 +395,128 @@ int sounder_pid;
 
 /* Drawer vars */
 // the whole display is represented here: 1 pixel = 1 cell
-char display[SCREEN_SIZE + 1];
-// Saves the color of each cell in the display
-char display_color[SCREEN_SIZE + 1];
-// a draft of the display, later we copy the draft to the display array
-char display_draft[SCREEN_HEIGHT][SCREEN_WIDTH];
-// a draft of the display color
-char display_draft_color[SCREEN_HEIGHT][SCREEN_WIDTH];
+// every cell is a char + color word, laid out exactly like the screen memory
+// so printing it is a plain block copy
+// There are two frames: the updater draws into one (the draft)
+// while the drawer prints the other one (the display frame)
+unsigned int display_frames[2][SCREEN_HEIGHT][SCREEN_WIDTH];
+// The frame the updater is drawing into
+unsigned int (*display_draft)[SCREEN_WIDTH] = display_frames[0];
+// The index of the draft in display_frames
+int draft_frame_index = 0;
+// The index of the last published frame in display_frames
+int display_frame_index = 1;
+// Is there a published frame that the drawer did not print yet ?
+int frame_pending = 0;
+// Is the drawer printing the display frame right now ?
+int frame_printing = 0;
+// The first and last column of every row of the frame that changed since the frame that was published before it
+// (-1 = nothing changed in this row)
+int dirty_row_start[2][SCREEN_HEIGHT];
+int dirty_row_end[2][SCREEN_HEIGHT];
+// The changed columns of every row that each screen page still needs to get
+// (the frames changes are owed to both pages, but every frame is printed to only one of them)
+int page_dirty_start[SCREEN_PAGES][SCREEN_HEIGHT];
+int page_dirty_end[SCREEN_PAGES][SCREEN_HEIGHT];
+// The page of the render backend that is shown right now
+int visible_page = 0;
+// How the printed pages are shown (PRESENT_IMMEDIATE / PRESENT_VSYNC)
+int present_mode = PRESENT_VSYNC;
+// How many frames were printed
+int frames_printed = 0;
+// How many of the printed frames missed the vertical retrace they were printed for
+int retrace_misses = 0;
+
+/* Frame history vars */
+// The changes of the last printed frames, oldest first, every frame is saved as:
+// frame number, elapsed time, spans count, and for every span: first cell, cells count, the cells
+unsigned int frame_history[FRAME_HISTORY_WORDS];
+// Where the next word is written / where the oldest frame starts
+int frame_history_head = 0;
+int frame_history_tail = 0;
+// How many words / frames are saved
+int frame_history_used = 0;
+int frame_history_frames = 0;
+// The screen before the oldest saved frame
+// When the oldest frame is dropped, it's changes are applied here
+unsigned int frame_history_base[SCREEN_SIZE];
+// Did the user ask to save the history to a file ?
+int frame_history_dump_requested = 0;
+// How many cells were written to the screen in the last printed frame
+int cells_written_last_frame = 0;
+
+/* Memory screen vars */
+// The screen of the headless render backend
+unsigned int memory_screen[SCREEN_SIZE];
+// How many times the memory screen was shown
+int memory_screen_shows = 0;
+
+/* Background vars */
+// The static parts of the level (the map, the ladders, kong and the princess)
+// drawn once when the level is loaded
+unsigned int level_background[SCREEN_HEIGHT][SCREEN_WIDTH];
+// The level that is drawn in the background (0 = none)
+int background_level = 0;
+// Changes every time the background is drawn again
+int background_version = 0;
+// The version of the background every frame holds (-1 = the frame holds a menu)
+int frame_background_version[2] = { -1, -1 };
+// The areas every frame drew on top of the background
+// Only these areas need to be restored to get back a clean background
+rect drawn_rects[2][MAX_DRAWN_RECTS];
+// How many areas every frame drew on top of the background
+int drawn_rects_count[2] = { 0 };
 
 /* Game vars */
 int game_level = 1;
+// The time of the simulation (in ticks), every step of the simulation moves it one tick
+// it follows elapsed_time, as long as the updater keeps up
+unsigned int game_time = 0;
+// How many ticks the simulation dropped because it was too far behind
+int dropped_ticks = 0;
 // Mario got to the princess ?
 int mario_got_to_princess = 0;
 // The counter that holds how many lifes mario has
 int player_lives = PLAYER_LIFE_COUNT;
-// Holds the score of the player
-int player_score = 0;
+// Holds the score of the player, a digit (char) for every decimal digit
+char player_score_digits[SCORE_DIGITS + 1] = "00000";
 // The index of the selected button on the menu
 int menu_index = 0;
+// Does the menu need to be drawn again ? (the state or the selected button changed)
+int menu_redraw = 1;
+// Was the menu drawn into the draft but not published yet ?
+int menu_publish_pending = 0;
 // is the game ready for playing ?
 int game_init = 0;
 // Saves the prev game state
-enum GameState prev_game_state = -1;
+GameState prev_game_state = -1;
 // Holds the current state of the game (in game, in game over, in menu...)
-enum GameState gameState = InMenu;
+GameState gameState = InMenu;
+
+/* HUD vars */
+// The text of the clock (MM:SS), advanced every second
+char clock_text[6] = "00:00";
+// A heart for every life the player has (aligned to the right)
+char player_lives_text[PLAYER_LIFE_COUNT + 1] = "$$$";
+// The debug numbers
+char debug_spawn_timer_text[4] = "   ";
+char debug_barrels_used_text[3] = "  ";
+char debug_lost_ticks_text[4] = "   ";
+char debug_cells_written_text[5] = "    ";
+char debug_retrace_misses_text[4] = "   ";
+widget clock_widget = {SCREEN_WIDTH - 5, 0, 5, 12, clock_text, ALL_FRAMES_MASK, -1};
+widget lives_widget = {SCREEN_WIDTH - 7 - PLAYER_LIFE_COUNT + 1, 0, PLAYER_LIFE_COUNT, 4, player_lives_text, ALL_FRAMES_MASK, -1};
+widget score_widget = {SCREEN_WIDTH - 11 - SCORE_DIGITS + 1, 0, SCORE_DIGITS, 15, player_score_digits, ALL_FRAMES_MASK, -1};
+widget debug_spawn_timer_widget = {4, 0, 3, 12, debug_spawn_timer_text, ALL_FRAMES_MASK, -1};
+widget debug_barrels_used_widget = {0, 0, 2, 12, debug_barrels_used_text, ALL_FRAMES_MASK, -1};
+widget debug_lost_ticks_widget = {8, 0, 3, 12, debug_lost_ticks_text, ALL_FRAMES_MASK, -1};
+widget debug_cells_written_widget = {12, 0, 4, 12, debug_cells_written_text, ALL_FRAMES_MASK, -1};
+widget debug_retrace_misses_widget = {17, 0, 3, 12, debug_retrace_misses_text, ALL_FRAMES_MASK, -1};
+// The widgets that are drawn in the game
+widget* hud_widgets[HUD_WIDGETS_COUNT] = {
+    &clock_widget, &lives_widget, &score_widget, &debug_spawn_timer_widget, &debug_barrels_used_widget,
+    &debug_lost_ticks_widget, &debug_cells_written_widget, &debug_retrace_misses_widget
+};
 
 /* Player vars */
 char mario_model[3][3] = 
@@ -199,10 +525,9 @@ char mario_model[3][3] =
     "-#-",
     "| |"
 };
-// The game object of the player
-gameObject playerObject = {"Player", {PLAYER_START_POS_X, PLAYER_START_POS_Y}, 3, 3, (char**) mario_model};
+sprite mario_sprite = {(char*) mario_model, 3, 3, 14};
 // Saves the time that the player jumped (used to know if to apply gravity to the player)
-int air_duration_elapsed = 0;
+unsigned int air_duration_elapsed = 0;
 // is the player on top of a ladder
 int on_top_ladder = 0;
 // is the player with the hammer
@@ -215,8 +540,7 @@ char princess_model[2][2] = {
     "$$",
     "$$"
 };
-// The game object of the princess
-gameObject princessObject = {"Princess", {35 ,2}, 2, 2, (char**) princess_model};
+sprite princess_sprite = {(char*) princess_model, 2, 2, 13};
 
 /* Kong vars */
 char kong_model[3][3] = 
@@ -225,22 +549,22 @@ char kong_model[3][3] =
     "<#>",
     "V V"
 };
-// The game object of kong
-gameObject kongObject = {"Kong", {22, 5}, 3, 3, (char**) kong_model};
+sprite kong_sprite = {(char*) kong_model, 3, 3, 6};
 
 /* Hammer vars */
 char hammer_model[1][2] = 
 {
     "%%"
 };
-// The game object of THE HAMMER
-gameObject hammerObject = {"Hammer", {37, 20}, 2, 1, (char**) hammer_model};
+sprite hammer_sprite = {(char*) hammer_model, 2, 1, 15};
 // Count how many hits left to the hammer
 int hammer_hits_left = HAMMER_MAX_HITS;
 // The time it takes to recover from a hit
-int hammer_hit_duration = 0;
+unsigned int hammer_hit_duration = 0;
 // Is the hammer in the map
 int is_hammer_exist = 0;
+// Is the hammer in the middle of a hit (the barrels step checks what barrels it hits)
+int is_hammer_striking = 0;
 
 /* Barrels vars*/
 char barrel_model[1][2] = 
@@ -251,31 +575,123 @@ char falling_barrel_model[1][2] =
 {
     "OO"
 };
-// Array that holds all the barrels that are in the game
-barrel* barrels_array[MAX_GAME_OBJECTS];
-// The index that iterate the barrels array
-int barrels_array_index = 0;
-// Timer to know when to spawn a new barrel
-int spawn_barrel_timer = 0;
+sprite barrel_sprite = {(char*) barrel_model, 2, 1, 3};
+sprite falling_barrel_sprite = {(char*) falling_barrel_model, 2, 1, 9};
+// The barrels that are in the game, packed at the start of the arrays (0 to barrels_count - 1)
+// one array for every field, so every pass on the barrels goes only through the live ones
+// when a barrel is deleted the last barrel is moved to it's place
+int barrels_count = 0;
+// Where the barrel is (top left), all the barrels are BARREL_WIDTH x BARREL_HEIGHT
+int barrel_x[MAX_GAME_OBJECTS];
+int barrel_y[MAX_GAME_OBJECTS];
+// When to move the barrel (game_time)
+unsigned int barrel_move_time[MAX_GAME_OBJECTS];
+// Is the barrel grounded ?
+int barrel_is_grounded[MAX_GAME_OBJECTS];
+// The direction of the movement (1 = Right, -1 = Left)
+int barrel_movement_direction[MAX_GAME_OBJECTS];
+// Is the barrel a falling down barrel ?
+int barrel_is_falling[MAX_GAME_OBJECTS];
+// When to drop the falling barrel (game_time)
+unsigned int barrel_fall_time[MAX_GAME_OBJECTS];
+// The step of the barrels trajectory the barrel is on (-1 = not on the trajectory, moved by the map)
+int barrel_trajectory_step[MAX_GAME_OBJECTS];
+// The barrels index: every row of the screen keeps a list of the barrels in it (by their top, clamped to the screen)
+// so a box is tested only against the barrels in it's rows
+// The row of every barrel and where it is in the list of the row
+int barrel_index_row[MAX_GAME_OBJECTS];
+int barrel_index_slot[MAX_GAME_OBJECTS];
+// The barrels in every row, and how many
+char row_barrels[SCREEN_HEIGHT][MAX_GAME_OBJECTS];
+int barrels_row_count[SCREEN_HEIGHT];
+// The barrels a box can touch (taken from the index for a test) and what the test found for each of them
+int near_barrels[MAX_GAME_OBJECTS];
+char near_barrel_hits[MAX_GAME_OBJECTS];
+// What barrels the hammer / the player collided with in the last test (1 = collided), by the index of the barrel
+char barrel_hammer_hits[MAX_GAME_OBJECTS];
+char barrel_player_hits[MAX_GAME_OBJECTS];
+// The path a barrel takes from kong until it leaves the screen (built when the level is loaded)
+// so moving a barrel is going to the next step, without checking the map
+trajectoryStep barrel_trajectory[MAX_TRAJECTORY_STEPS];
+int barrel_trajectory_length = 0;
+// The grounded steps of the trajectory by their position, so a landing barrel finds it's step without going through all of them
+// A step is kept in the slot of it's position (see get_trajectory_index_slot), the first step of every slot is in trajectory_index
+// and the next step of the same slot in trajectory_index_next (-1 = no more steps), the steps of a slot are in the order of the path
+int trajectory_index[TRAJECTORY_INDEX_SLOTS];
+int trajectory_index_next[MAX_TRAJECTORY_STEPS];
 // How long do we wait between spawning a new barrel
-int spawn_barrel_speed_in_ticks = 6 * 18;
+int spawn_barrel_speed_in_ticks = TICKS(6 * 18);
 // How long do we wait between moving the barrels
-int barrel_movement_speed_in_ticks = 5;
-// Timer to know when to spawn a new falling barrel
-int spawn_falling_barrel_timer = 0;
+int barrel_movement_speed_in_ticks = TICKS(5);
 // How long do we wait between spawning a new falling barrel
-int spawn_falling_barrel_speed_in_ticks = 4 * 18;
+int spawn_falling_barrel_speed_in_ticks = TICKS(4 * 18);
+
+/* Entities vars */
+// All the game objects of the game (but the barrels), the positions come from the level
+gameObject entities[MAX_ENTITIES] = {
+    {KindPlayer, OBJECT_ACTIVE | OBJECT_CLIMBS | OBJECT_HURT_BY_BARRELS, {0, 0}, 3, 3, &mario_sprite},
+    {KindPrincess, OBJECT_ACTIVE | OBJECT_IN_BACKGROUND, {0, 0}, 2, 2, &princess_sprite},
+    {KindKong, OBJECT_ACTIVE | OBJECT_IN_BACKGROUND, {0, 0}, 3, 3, &kong_sprite},
+    {KindHammer, OBJECT_ACTIVE, {37, 20}, 2, 1, &hammer_sprite}
+};
+// The game object of the player
+gameObject* playerObject = &entities[ENTITY_PLAYER];
+// The game object of the princess
+gameObject* princessObject = &entities[ENTITY_PRINCESS];
+// The game object of kong
+gameObject* kongObject = &entities[ENTITY_KONG];
+// The game object of THE HAMMER
+gameObject* hammerObject = &entities[ENTITY_HAMMER];
 
 /* Ladders vars */
-// Using a pointer to know what (level) ladders to draw
-char* ladder_map_ptr = NULL;
-gameObject laddersObject = {"Ladders", {0,0}, SCREEN_WIDTH, SCREEN_HEIGHT, (char**) ladders_level_1};
+gameObject laddersObject = {KindLadders, 0, {0,0}, SCREEN_WIDTH, SCREEN_HEIGHT, NULL};
+
+/* Screens vars */
+// The screen (a menu or the map of a level) that was unpacked last
+// only one screen is unpacked at a time, the packed screens are in maps.h
+char unpacked_screen[SCREEN_HEIGHT][SCREEN_WIDTH];
+
+/* Levels vars */
+// The levels of the game, the built in levels (maps.h) or the levels of the level pack
+levelInfo levels[MAX_LEVELS];
+int levels_count = 0;
+// The level that is played
+levelInfo* current_level = NULL;
+// The ladders, hammer platforms and maps of the levels of the level pack (the levels point into these)
+ladderSegment level_pack_ladders[LEVEL_PACK_MAX_LADDERS];
+int level_pack_ladders_used = 0;
+hammerPlatform level_pack_hammer_platforms[LEVEL_PACK_MAX_HAMMER_PLATFORMS];
+int level_pack_hammer_platforms_used = 0;
+unsigned char level_pack_maps[LEVEL_PACK_MAPS_BYTES];
+unsigned int level_pack_maps_used = 0;
+
+/* Tiles vars */
+// The tiles of the level, a bit for every cell (built when the level is loaded)
+// Saved by rows (16 cells in a word) and by columns (a bit for every row, the whole column fits in a long)
+// so checking a row or a column of an object is a few masks
+unsigned int tile_rows[TILE_KINDS][SCREEN_HEIGHT][TILE_ROW_WORDS];
+unsigned long tile_columns[TILE_KINDS][SCREEN_WIDTH];
 
 /* Gravity vars */
 // Apply gravity every number of ticks
-int apply_gravity_every_ticks = 5;
-// The counter of passed ticks
-int gravity_ticks = 5;
+int apply_gravity_every_ticks = TICKS(5);
+
+/* Timers vars */
+// The timers of the game events (TIMER_...), every timer is due at a game_time
+// A timer is kept in the slot of the wheel of it's due time (due time % TIMER_WHEEL_SLOTS)
+// so moving the time forward goes only through the timers of the slots that came up
+// The first timer in every slot of the wheel (-1 = none)
+int timer_wheel[TIMER_WHEEL_SLOTS];
+// The next timer in the slot of the timer (-1 = none)
+int timer_next[TIMERS_COUNT];
+// When the timer is due
+unsigned int timer_due_time[TIMERS_COUNT];
+// Is the timer in the wheel ?
+int timer_is_scheduled[TIMERS_COUNT];
+// Did the timer fire (and it was not handled yet) ?
+int timer_fired[TIMERS_COUNT];
+// The time the wheel got to
+unsigned int timer_wheel_time = 0;
 
 /* Screen vars */
 // Saves the color byte of the screen before the game
@@ -283,13 +699,34 @@ char saved_color_byte;
 // Is the user exited the game
 int game_exited = 0;
 // Screen game object, used to detect if the objects are inside it
-gameObject screenObject = {"Screen", {0,0}, SCREEN_WIDTH, SCREEN_HEIGHT, (char**) map_1};
+gameObject screenObject = {KindScreen, 0, {0,0}, SCREEN_WIDTH, SCREEN_HEIGHT, NULL};
+
+// Tells the clock in how many ticks the game needs to run next (used in tickless mode, 0 = nothing is due)
+// a closer deadline cuts the shot of the PIT that is running, so the tick is not late
+void update_clock_deadline(int ticks){
+    int ps;
+
+    disable(ps);
+    clock_deadline_ticks = ticks;
+    rearm_clock_shot();
+    restore(ps);
+}
+
+// Sets the deadline of the state of the game
+// in the game it's every tick (until the updater knows better), the menus wait only for input so the tick of XINU is enough
+void set_clock_deadline(){
+    if (gameState == InGame) update_clock_deadline(1);
+    else update_clock_deadline(0);
+}
 
 // Changes the state of the game
 // Also saves the prev one
 void change_game_state(GameState new_state){
     prev_game_state = gameState;
+    // A new state, a new menu
+    menu_redraw = 1;
     gameState = new_state;
+    set_clock_deadline();
 }
 
 // Turns the speaker on or off
@@ -298,12 +735,14 @@ void set_speaker(int status){
     int port_val = 0;
 
     // Getting the info from port 61h
+#ifndef KONG_HEADLESS
     asm{
         PUSH AX
         MOV AL, 61h
         MOV BYTE PTR port_val, AL
         POP AX
     }
+#endif
 
     // if we want to turn on the speakers we need to switch on bit 1 and 2
     // if we want to turn off the speakers we need to switch off bit 1 and 2
@@ -312,12 +751,14 @@ void set_speaker(int status){
     else port_val &=~ 3;
 
     // Setting the action we want after we changed the values (we need to set them back to port 61h)
+#ifndef KONG_HEADLESS
     asm{
         PUSH AX
         MOV AX, WORD PTR port_val
         OUT 61h, AL
         POP AX
     }
+#endif
 }
 
 // Plays sound with the freq set to hertz
@@ -331,15 +772,18 @@ void play_sound(int hertz){
     // Setting our wanted vars to the PIT
     // 0B6h = 10110110
     // Left-To-Right: 10 - PIT Counter 2, 11 Read/Write lower byte first, 011 Mode 3, 0 Binary Counting
+#ifndef KONG_HEADLESS
     asm{
         PUSH AX
         MOV AL, 0B6h
         OUT 43h, AL
         POP AX
     }
+#endif
 
     // Port 42 for Counter #2
     // Setting the counter (LSB)
+#ifndef KONG_HEADLESS
     asm{
         PUSH AX
         MOV AX, WORD PTR final_counter
@@ -347,8 +791,10 @@ void play_sound(int hertz){
         OUT 42h, AL
         POP AX
     }
+#endif
 
     // Setting the counter (MSB)
+#ifndef KONG_HEADLESS
     asm{
         PUSH AX
         MOV AX, WORD PTR final_counter
@@ -356,6 +802,7 @@ void play_sound(int hertz){
         OUT 42h, AL
         POP AX
     }
+#endif
 }
 
 // Turns the speakers off
@@ -377,18 +824,139 @@ void send_sound(int hertz){
     send(sounder_pid, hertz);
 }
 
+// The widget's text changed, all the frames need to get it
+void invalidate_widget(widget* w){
+    w->redraw_mask = ALL_FRAMES_MASK;
+}
+
+// Marks the widgets that are in the area to be drawn again into the draft
+// (something was drawn on top of them, or it was restored to the background)
+void invalidate_widgets_in_rect(rect* area){
+    int i = 0;
+    widget* w;
+
+    for (i = 0; i < HUD_WIDGETS_COUNT; i++){
+        w = hud_widgets[i];
+        if (w->y < area->y || w->y >= area->y + area->height) continue;
+        if (w->x + w->length <= area->x || w->x >= area->x + area->width) continue;
+
+        w->redraw_mask |= FRAME_BIT(draft_frame_index);
+    }
+}
+
+// Sets the number that the widget shows (a negative number shows nothing)
+// The text is changed only if the number changed
+void set_widget_number(widget* w, int value){
+    int i = 0;
+
+    if (value == w->value) return;
+    w->value = value;
+
+    for (i = w->length - 1; i >= 0; i--){
+        if (value < 0){
+            w->text[i] = ' ';
+        }else {
+            // int to ascii
+            w->text[i] = (value % 10) + '0';
+            value /= 10;
+        }
+    }
+
+    invalidate_widget(w);
+}
+
+// Sets the hearts of the lives widget to the player's lives
+void update_player_lives_text(){
+    int i = 0;
+
+    for (i = 0; i < PLAYER_LIFE_COUNT; i++){
+        // The hearts are aligned to the right
+        if (i < player_lives) player_lives_text[PLAYER_LIFE_COUNT - 1 - i] = '$';
+        else player_lives_text[PLAYER_LIFE_COUNT - 1 - i] = ' ';
+    }
+
+    invalidate_widget(&lives_widget);
+}
+
+// Advances the clock text by a second
+// The digits are counted with a carry (no dividing every time we draw it)
+void advance_clock_text(){
+    // Seconds
+    clock_text[4]++;
+    if (clock_text[4] <= '9') return;
+    clock_text[4] = '0';
+    clock_text[3]++;
+    if (clock_text[3] <= '5') return;
+    clock_text[3] = '0';
+
+    // Minutes
+    clock_text[1]++;
+    if (clock_text[1] <= '9') return;
+    clock_text[1] = '0';
+    clock_text[0]++;
+    if (clock_text[0] <= '9') return;
+    clock_text[0] = '0';
+}
+
 // Adds/Subs from the player's lives
 void add_player_life(int lp){
     player_lives += lp;
+    update_player_lives_text();
+}
+
+// Sets the player's score to 0
+void reset_score_points(){
+    int i = 0;
+
+    for (i = 0; i < SCORE_DIGITS; i++){
+        player_score_digits[i] = '0';
+    }
+
+    invalidate_widget(&score_widget);
 }
 
 // Adds score points the the player's score
+// The points are added digit by digit (from the lowest one) with a carry / borrow
+// (the time handler adds points every second and minute and can cut in, so the digits are changed with the interrupts disabled)
 void add_score_points(int points){
-    player_score += points;
+    int i = 0;
+    int sign = 1;
+    int carry = 0;
+    int digit;
+    int ps;
+
+    if (points < 0){
+        sign = -1;
+        points = -points;
+    }
+
+    disable(ps);
+    for (i = SCORE_DIGITS - 1; i >= 0 && (points > 0 || carry != 0); i--){
+        digit = player_score_digits[i] - '0' + sign * (points % 10) + carry;
+        points /= 10;
+
+        carry = 0;
+        if (digit > 9){
+            digit -= 10;
+            carry = 1;
+        }else if (digit < 0){
+            digit += 10;
+            carry = -1;
+        }
+
+        player_score_digits[i] = digit + '0';
+    }
+
+    // Boundries for the score, the points did not fit in the digits
+    if (points > 0 || carry != 0){
+        for (i = 0; i < SCORE_DIGITS; i++){
+            if (sign > 0) player_score_digits[i] = '9';
+            else player_score_digits[i] = '0';
+        }
+    }
+    restore(ps);
 
-    // Boundries for the score
-    if (player_score > MAX_POINTS) player_score = MAX_POINTS;
-    if (player_score < MIN_POINTS) player_score = MIN_POINTS;
+    invalidate_widget(&score_widget);
 }
 
 // Decrease the player's life by 1
@@ -398,87 +966,731 @@ void sub_player_life(){
     add_score_points(POINTS_LOSING_LIFE);
 }
 
-// This function is used to better print to the console
-// Avoiding flickering, more color options and shit...
-void print_to_screen(){
+// Extends the changed columns of a row ([row_start, row_end]) to include [start, end]
+void extend_dirty_span(int* row_start, int* row_end, int start, int end){
+    // Nothing changed in the row yet
+    if (*row_start < 0){
+        *row_start = start;
+        *row_end = end;
+        return;
+    }
+
+    if (start < *row_start) *row_start = start;
+    if (end > *row_end) *row_end = end;
+}
+
+// Marks the cells [start, end] of the row of the draft as changed
+// so they will be printed when the draft is published
+void mark_dirty_cells(int row, int start, int end){
+    extend_dirty_span(&dirty_row_start[draft_frame_index][row], &dirty_row_end[draft_frame_index][row], start, end);
+}
+
+// Sets a cell of the display draft
+// Marks the cell only if it's different from the last published frame
+void set_draft_cell(int y, int x, char pixel, char color_byte){
+    unsigned int cell = MAKE_CELL(pixel, color_byte);
+
+    // The draft holds the frame from 2 publishes ago, so we always write to it
+    display_draft[y][x] = cell;
+
+    if (display_frames[display_frame_index][y][x] != cell) mark_dirty_cells(y, x, x);
+}
+
+// Marks the whole draft as changed
+void mark_all_dirty(){
+    int i = 0;
+
+    for (i = 0; i < SCREEN_HEIGHT; i++){
+        mark_dirty_cells(i, 0, SCREEN_WIDTH - 1);
+    }
+}
+
+// Marks the cells of the rect that are different in the draft and the display frame
+void mark_changed_cells_in_rect(rect* area){
     int i = 0;
     int j = 0;
-    char current_pixel;
-    char current_color;
 
-    // The default color byte that we use to print to the console
-    // the default is white text with black background
-    // 15 = 00001111 = white text black bg
-    // 12 = 00001100 = red text black bg
-    char default_color_byte = 15;
+    for (i = area->y; i < area->y + area->height; i++){
+        for (j = area->x; j < area->x + area->width; j++){
+            if (display_draft[i][j] != display_frames[display_frame_index][i][j]) mark_dirty_cells(i, j, j);
+        }
+    }
+}
+
+// Saves an area that was drawn into the draft on top of the background
+// so it will be restored the next time we draw into this frame
+void record_drawn_rect(int x, int y, int width, int height){
+    rect area;
+
+    // Clipping the area to the screen
+    if (x < 0){
+        width += x;
+        x = 0;
+    }
+    if (y < 0){
+        height += y;
+        y = 0;
+    }
+    if (x + width > SCREEN_WIDTH) width = SCREEN_WIDTH - x;
+    if (y + height > SCREEN_HEIGHT) height = SCREEN_HEIGHT - y;
+    if (width <= 0 || height <= 0) return;
+
+    area.x = x;
+    area.y = y;
+    area.width = width;
+    area.height = height;
+
+    // The HUD is drawn on top of what is drawn here
+    invalidate_widgets_in_rect(&area);
+
+    // No more room, we cant know what to restore so the frame will be restored whole next time
+    if (drawn_rects_count[draft_frame_index] >= MAX_DRAWN_RECTS){
+        frame_background_version[draft_frame_index] = -1;
+        return;
+    }
+
+    drawn_rects[draft_frame_index][drawn_rects_count[draft_frame_index]] = area;
+    drawn_rects_count[draft_frame_index]++;
+}
 
-    // Init the screen to top left point
+// Copies count cells from source to destination (both in our data segment)
+void copy_cells(unsigned int* destination, unsigned int* source, int count){
+#ifdef KONG_HEADLESS
+    memmove(destination, source, count * sizeof(unsigned int));
+#else
+    asm{
+        PUSH DS
+        POP ES
+        MOV DI, WORD PTR destination
+        MOV SI, WORD PTR source
+        MOV CX, WORD PTR count
+        CLD
+        REP MOVSW
+    }
+#endif
+}
+
+// Publishes the draft as the next frame to print, and makes the other frame the new draft
+// If the drawer is printing right now, nothing happens and we keep drawing into the same draft
+// Returns 1 if the draft was published
+int publish_display_draft(){
+    int i = 0;
+    int ps;
+
+    // The areas the display frame drew on top of the background are not in the draft (we restored them)
+    // so they changed where the draft did not draw the same thing
+    for (i = 0; i < drawn_rects_count[display_frame_index]; i++){
+        mark_changed_cells_in_rect(&drawn_rects[display_frame_index][i]);
+    }
+
+    disable(ps);
+
+    // The drawer is still printing the display frame, so we cant draw into it
+    // The draft will be published next time (with the changes of this time)
+    if (frame_printing){
+        restore(ps);
+        return 0;
+    }
+
+    // The last published frame was never printed, the screen still shows the one before it
+    // so the changes of that frame need to be printed with ours
+    if (frame_pending){
+        for (i = 0; i < SCREEN_HEIGHT; i++){
+            if (dirty_row_start[display_frame_index][i] >= 0)
+                mark_dirty_cells(i, dirty_row_start[display_frame_index][i], dirty_row_end[display_frame_index][i]);
+        }
+    }
+
+    // Swapping the frames
+    display_frame_index = draft_frame_index;
+    draft_frame_index = 1 - draft_frame_index;
+    display_draft = display_frames[draft_frame_index];
+
+    // The new draft has no changes yet
+    for (i = 0; i < SCREEN_HEIGHT; i++){
+        dirty_row_start[draft_frame_index][i] = -1;
+        dirty_row_end[draft_frame_index][i] = -1;
+    }
+
+    frame_pending = 1;
+
+    restore(ps);
+
+    return 1;
+}
+
+// Marks both screen pages as unknown, so the next frames are printed whole to them
+void mark_all_pages_dirty(){
+    int i = 0;
+    int page = 0;
+
+    for (page = 0; page < SCREEN_PAGES; page++){
+        for (i = 0; i < SCREEN_HEIGHT; i++){
+            page_dirty_start[page][i] = 0;
+            page_dirty_end[page][i] = SCREEN_WIDTH - 1;
+        }
+    }
+}
+
+// Shows the screen page
+// by setting the start address of the CRT controller (port 3D4h) to the start of the page
+void show_screen_page(int page){
+    // The start address is counted in cells (2 bytes)
+    unsigned int start_address = page * (SCREEN_PAGE_SIZE / 2);
+
+    // 0Ch = start address high byte, 0Dh = start address low byte
+    // OUT DX, AX writes the index (AL) to 3D4h and the value (AH) to 3D5h
+#ifndef KONG_HEADLESS
+    asm{
+        MOV BX, WORD PTR start_address
+        MOV DX, 3D4h
+        MOV AL, 0Ch
+        MOV AH, BH
+        OUT DX, AX
+        MOV AL, 0Dh
+        MOV AH, BL
+        OUT DX, AX
+    }
+#endif
+}
+
+// Returns 1 if the screen is in vertical retrace right now
+int in_vertical_retrace(){
+    char status = 0;
+
+    // Bit 3 of the input status register (port 3DAh) is on during the vertical retrace
+#ifndef KONG_HEADLESS
+    asm{
+        MOV DX, 3DAh
+        IN AL, DX
+        MOV BYTE PTR status, AL
+    }
+#endif
+
+    return (status & 8) != 0;
+}
+
+// Waits until the screen is (or is not) in vertical retrace
+// Returns 0 if we gave up waiting
+int wait_for_retrace(int retrace){
+    int i = 0;
+
+    for (i = 0; i < RETRACE_WAIT_LIMIT; i++){
+        if (in_vertical_retrace() == retrace) return 1;
+    }
+
+    return 0;
+}
+
+// Shows the page synced to the vertical retrace
+// The start address is taken by the screen at the start of the retrace
+// so we set it while the screen is drawing and then wait for the retrace to take it
+void show_screen_page_synced(int page){
+    // The retrace already started, it's too late for this one
+    // the page will be shown only on the next retrace
+    if (in_vertical_retrace()){
+        retrace_misses++;
+        wait_for_retrace(0);
+    }
+
+    show_screen_page(page);
+
+    // Waiting for the page to really be shown
+    // so the next frame wont be printed into the page that is still on the screen
+    if (!wait_for_retrace(1)) retrace_misses++;
+}
+
+// Shows the screen page, synced to the vertical retrace if the present mode says so
+void vga_show_page(int page){
+    if (present_mode == PRESENT_VSYNC) show_screen_page_synced(page);
+    else show_screen_page(page);
+}
+
+// Copies count cells, starting from first_cell, to the screen page
+void vga_print_cells(int page, int first_cell, unsigned int* cells, int count){
+    // Every cell of the screen is 2 bytes (char + color)
+    int offset = page * SCREEN_PAGE_SIZE + first_cell * 2;
+
+    // ES:DI = the screen memory, DS:SI = the cells
+    // and copy the whole run in one go
+#ifndef KONG_HEADLESS
+    asm{
+        MOV AX, 0B800h
+        MOV ES, AX
+        MOV DI, WORD PTR offset
+        MOV SI, WORD PTR cells
+        MOV CX, WORD PTR count
+        CLD
+        REP MOVSW
+    }
+#endif
+}
+
+// Fills the first screen page with blank cells and goes back to it, that is the one DOS uses
+void vga_clear(){
+    // A blank cell, white text black background
+    unsigned int blank_cell = MAKE_CELL(' ', 15);
+    int screen_size = SCREEN_SIZE;
+
+    show_screen_page(0);
+
+#ifndef KONG_HEADLESS
     asm{
         MOV AX, 0B800h
         MOV ES, AX
         MOV DI, 0
+        MOV AX, WORD PTR blank_cell
+        MOV CX, WORD PTR screen_size
+        CLD
+        REP STOSW
+    }
+#endif
+}
+
+// Copies count cells, starting from first_cell, to the memory screen
+void memory_print_cells(int page, int first_cell, unsigned int* cells, int count){
+    copy_cells(&memory_screen[first_cell], cells, count);
+}
+
+// The memory screen is not shown anywhere, only counting it
+void memory_show_page(int page){
+    memory_screen_shows++;
+}
+
+// Fills the memory screen with blank cells
+void memory_clear(){
+    int i = 0;
+
+    for (i = 0; i < SCREEN_SIZE; i++){
+        memory_screen[i] = MAKE_CELL(' ', 15);
+    }
+}
+
+/* Render backends */
+// The text mode screen, with it's pages and the vertical retrace
+renderBackend vga_backend = { "VGA", SCREEN_PAGES, vga_print_cells, vga_show_page, vga_clear };
+// A screen in memory, nothing is shown (for running the frames without a screen)
+renderBackend memory_backend = { "Memory", MEMORY_SCREEN_PAGES, memory_print_cells, memory_show_page, memory_clear };
+
+// The backend the frames are printed to
+#ifdef KONG_HEADLESS
+renderBackend* render_backend = &memory_backend;
+#else
+renderBackend* render_backend = &vga_backend;
+#endif
+
+// Creates a file (or truncates it), using DOS (int 21h)
+// Returns the handle of the file, -1 if failed
+int dos_create_file(char* file_name){
+    int handle = -1;
+
+    // AH = 3Ch: create file, CX = attributes, DS:DX = the file name
+    // the carry flag is on if failed, otherwise AX = the handle
+#ifndef KONG_HEADLESS
+    asm{
+        MOV AH, 3Ch
+        MOV CX, 0
+        MOV DX, WORD PTR file_name
+        INT 21h
+        JC CREATE_FAILED
+        MOV WORD PTR handle, AX
+    }
+#endif
+
+    CREATE_FAILED:
+    return handle;
+}
+
+// Writes bytes to a file, using DOS (int 21h)
+// Returns 1 if all the bytes were written
+int dos_write_file(int handle, void* buffer, unsigned int bytes){
+    unsigned int written = 0;
+
+    // AH = 40h: write to file, BX = the handle, CX = how many bytes, DS:DX = the buffer
+    // the carry flag is on if failed, otherwise AX = how many bytes were written
+#ifndef KONG_HEADLESS
+    asm{
+        MOV AH, 40h
+        MOV BX, WORD PTR handle
+        MOV CX, WORD PTR bytes
+        MOV DX, WORD PTR buffer
+        INT 21h
+        JC WRITE_FAILED
+        MOV WORD PTR written, AX
+    }
+#endif
+
+    WRITE_FAILED:
+    return written == bytes;
+}
+
+// Opens a file for reading, using DOS (int 21h)
+// Returns the handle of the file (-1 = failed)
+int dos_open_file(char* file_name){
+    int handle = -1;
+
+    // AH = 3Dh: open file, AL = 0 (read only), DS:DX = the file name
+    // the carry flag is on if failed, otherwise AX = the handle
+#ifndef KONG_HEADLESS
+    asm{
+        MOV AH, 3Dh
+        MOV AL, 0
+        MOV DX, WORD PTR file_name
+        INT 21h
+        JC OPEN_FAILED
+        MOV WORD PTR handle, AX
+    }
+#endif
+
+    OPEN_FAILED:
+    return handle;
+}
+
+// Reads bytes from a file, using DOS (int 21h)
+// Returns 1 if all the bytes were read
+int dos_read_file(int handle, void* buffer, unsigned int bytes){
+    unsigned int read = 0;
+
+    // AH = 3Fh: read from file, BX = the handle, CX = how many bytes, DS:DX = the buffer
+    // the carry flag is on if failed, otherwise AX = how many bytes were read
+#ifndef KONG_HEADLESS
+    asm{
+        MOV AH, 3Fh
+        MOV BX, WORD PTR handle
+        MOV CX, WORD PTR bytes
+        MOV DX, WORD PTR buffer
+        INT 21h
+        JC READ_FAILED
+        MOV WORD PTR read, AX
+    }
+#endif
+
+    READ_FAILED:
+    return read == bytes;
+}
+
+// Closes a file, using DOS (int 21h)
+void dos_close_file(int handle){
+    // AH = 3Eh: close file, BX = the handle
+#ifndef KONG_HEADLESS
+    asm{
+        MOV AH, 3Eh
+        MOV BX, WORD PTR handle
+        INT 21h
+    }
+#endif
+}
+
+// Saves a word in the frame history
+void push_frame_history_word(unsigned int word){
+    frame_history[frame_history_head] = word;
+    frame_history_head++;
+    if (frame_history_head >= FRAME_HISTORY_WORDS) frame_history_head = 0;
+    frame_history_used++;
+}
+
+// Takes the oldest word out of the frame history
+unsigned int pop_frame_history_word(){
+    unsigned int word = frame_history[frame_history_tail];
+
+    frame_history_tail++;
+    if (frame_history_tail >= FRAME_HISTORY_WORDS) frame_history_tail = 0;
+    frame_history_used--;
+
+    return word;
+}
+
+// Drops the oldest frame of the history
+// it's changes are applied to the base so the history still starts from a full screen
+void drop_oldest_frame_history(){
+    int spans_count;
+    unsigned int first_cell;
+    unsigned int cells_count;
+    unsigned int i = 0;
+
+    // The frame number and the elapsed time
+    pop_frame_history_word();
+    pop_frame_history_word();
+
+    spans_count = pop_frame_history_word();
+    while (spans_count > 0){
+        first_cell = pop_frame_history_word();
+        cells_count = pop_frame_history_word();
+        for (i = 0; i < cells_count; i++){
+            frame_history_base[first_cell + i] = pop_frame_history_word();
+        }
+        spans_count--;
+    }
+
+    frame_history_frames--;
+}
+
+// Saves the changes of the display frame (from the last printed frame) in the frame history
+// Called before the frame is printed
+void record_frame_history(){
+    int i = 0;
+    int j = 0;
+    int* frame_start = dirty_row_start[display_frame_index];
+    int* frame_end = dirty_row_end[display_frame_index];
+    unsigned int* frame = &display_frames[display_frame_index][0][0];
+    // How many words the frame needs in the history
+    int frame_size = 3;
+    int spans_count = 0;
+
+    for (i = 0; i < SCREEN_HEIGHT; i++){
+        if (frame_start[i] < 0) continue;
+        frame_size += 2 + frame_end[i] - frame_start[i] + 1;
+        spans_count++;
+    }
+
+    // Making room for the frame (a full frame always fits, see FRAME_HISTORY_WORDS)
+    while (FRAME_HISTORY_WORDS - frame_history_used < frame_size) drop_oldest_frame_history();
+
+    push_frame_history_word(frames_printed);
+    push_frame_history_word(elapsed_time);
+    push_frame_history_word(spans_count);
+    for (i = 0; i < SCREEN_HEIGHT; i++){
+        if (frame_start[i] < 0) continue;
+
+        push_frame_history_word(i * SCREEN_WIDTH + frame_start[i]);
+        push_frame_history_word(frame_end[i] - frame_start[i] + 1);
+        for (j = frame_start[i]; j <= frame_end[i]; j++){
+            push_frame_history_word(frame[i * SCREEN_WIDTH + j]);
+        }
+    }
+
+    frame_history_frames++;
+}
+
+// Saves the frame history to a file
+// The file is: "KHIS", version, screen width, screen height, frames count,
+// the base screen, and than the saved frames (oldest first)
+void dump_frame_history(){
+    unsigned int header[4];
+    int handle;
+    // The saved words from the oldest one until the end of the history array
+    int first_part;
+
+    handle = dos_create_file(FRAME_HISTORY_FILE_NAME);
+    if (handle < 0) return;
+
+    header[0] = FRAME_HISTORY_VERSION;
+    header[1] = SCREEN_WIDTH;
+    header[2] = SCREEN_HEIGHT;
+    header[3] = frame_history_frames;
+
+    first_part = FRAME_HISTORY_WORDS - frame_history_tail;
+    if (first_part > frame_history_used) first_part = frame_history_used;
+
+    if (dos_write_file(handle, "KHIS", 4) &&
+    dos_write_file(handle, header, sizeof(header)) &&
+    dos_write_file(handle, frame_history_base, sizeof(frame_history_base)) &&
+    dos_write_file(handle, &frame_history[frame_history_tail], first_part * 2)){
+        // The rest of the saved words are at the start of the history array
+        dos_write_file(handle, frame_history, (frame_history_used - first_part) * 2);
+    }
+
+    dos_close_file(handle);
+}
+
+// This function is used to better print to the console
+// Avoiding flickering, more color options and shit...
+// Prints the display frame to the hidden page of the render backend and than shows it
+// only the cells that the page is missing are written
+void print_to_screen(){
+    int i = 0;
+    int page = 0;
+    // The display frame is laid out like the screen, so the cell offset is the same in both of them
+    unsigned int* frame = &display_frames[display_frame_index][0][0];
+    // The next page, that is not shown (or the shown one if the backend has a single page)
+    int print_page = (visible_page + 1) % render_backend->pages_count;
+    // The changed columns of every row of the display frame
+    int* frame_start = dirty_row_start[display_frame_index];
+    int* frame_end = dirty_row_end[display_frame_index];
+    // The columns of every row the page is missing
+    int* row_start = page_dirty_start[print_page];
+    int* row_end = page_dirty_end[print_page];
+    // The first cell and the end (exclusive) of the changed cells of the row
+    int span_start;
+    int span_end;
+    // The run of changed cells we are about to print
+    // Rows that changed to their end and the next row that changed from it's start
+    // are joined to one run, so a full frame is printed with one copy
+    int run_start = -1;
+    int run_end = -1;
+
+    cells_written_last_frame = 0;
+
+    // Saving the changes of the frame before we take them
+    record_frame_history();
+
+    // The changes of the frame are missing from all of the pages
+    for (i = 0; i < SCREEN_HEIGHT; i++){
+        if (frame_start[i] < 0) continue;
+
+        for (page = 0; page < render_backend->pages_count; page++){
+            extend_dirty_span(&page_dirty_start[page][i], &page_dirty_end[page][i], frame_start[i], frame_end[i]);
+        }
+
+        frame_start[i] = -1;
+        frame_end[i] = -1;
     }
 
     for (i = 0; i < SCREEN_HEIGHT; i++){
-        for (j = 0; j < SCREEN_WIDTH; j++){
-            // Getting the char we need to print
-            current_pixel = display[i * SCREEN_WIDTH + j];
-            current_color = display_color[i * SCREEN_WIDTH + j];
-
-            // Printing the char to the console
-            // and advancing the index to the next cell of the console
-            asm{
-                MOV AL, BYTE PTR current_pixel
-                MOV AH, BYTE PTR current_color
-
-                MOV ES:[DI], AX
-                ADD DI, 2
+        // The page is not missing anything in this row
+        if (row_start[i] < 0) continue;
+
+        span_start = i * SCREEN_WIDTH + row_start[i];
+        span_end = i * SCREEN_WIDTH + row_end[i] + 1;
+
+        if (span_start == run_end){
+            // The span continues the run
+            run_end = span_end;
+        }else {
+            // Printing the last run and starting a new one
+            if (run_start >= 0){
+                render_backend->print_cells(print_page, run_start, frame + run_start, run_end - run_start);
+                cells_written_last_frame += run_end - run_start;
             }
+            run_start = span_start;
+            run_end = span_end;
         }
+
+        // The row of the page is up to date
+        row_start[i] = -1;
+        row_end[i] = -1;
+    }
+
+    // Printing the last run
+    if (run_start >= 0){
+        render_backend->print_cells(print_page, run_start, frame + run_start, run_end - run_start);
+        cells_written_last_frame += run_end - run_start;
     }
+
+    // The display frame is all in the page, the updater can publish into it again
+    // (showing the page can wait for the retrace, the frame is not needed for that)
+    frame_printing = 0;
+
+    // The frame is ready, showing it
+    render_backend->show_page(print_page);
+    visible_page = print_page;
+
+    frames_printed++;
 }
 
 // Wipes the entire screen
 void wipe_entire_screen(){
-    int i = 0;
-    int j = 0;
-
-    // Loop through the display var and fills it with empty spaces
-    // and fills the color of every cell with the default white text black background
-    for (i = 0; i < SCREEN_HEIGHT; i++){
-        for (j = 0; j < SCREEN_WIDTH; j++){
-            display[i * SCREEN_WIDTH + j] = ' ';
-            display_color[i * SCREEN_WIDTH + j] = 15;
-        }
-    }
-
     // The game is in exiting stage
     game_exited = 1;
+
     // Prints a black screen
-    print_to_screen();
+    render_backend->clear();
+    visible_page = 0;
 }
 
 // Returns the output to white text and black
 void reset_output_to_screen(){
     // Sets the color byte of the screen
+#ifndef KONG_HEADLESS
     asm{
         MOV AX, 0B800h
         MOV ES, AX
 
         MOV AH, BYTE PTR saved_color_byte
     }
+#endif
 }
 
 // Saves the color byte of the output to the console
 // so we can reset it when closing the game
 void save_out_to_screen(){
     // Saves the color byte of the screen
+#ifndef KONG_HEADLESS
     asm{
         MOV AX, 0B800h
         MOV ES, AX
 
         MOV saved_color_byte, AH
     }
+#endif
+}
+
+// Sets channel 0 of the PIT to run at the rate of the game (CLOCK_DIVISOR times the BIOS rate)
+// and tells clkint to divide it back for XINU (in tickless mode clkint sets every shot of the PIT)
+void set_game_clock(){
+    int ps;
+    // 0 is 65536, the rate of the BIOS
+    unsigned int pit_divisor = (unsigned int)(0x10000L / CLOCK_DIVISOR);
+
+    // Saving the time of the BIOS so we can fix it when the game ends
+    bios_start_ticks = biostime(0, 0L);
+
+    disable(ps);
+    clock_divisor = CLOCK_DIVISOR;
+    clock_divisor_count = 0;
+    clock_base_ticks = 0;
+    set_clock_deadline();
+
+    // The first shot, clkint sets the next ones
+    if (TICKLESS_CLOCK){
+        clock_tickless = 1;
+        program_clock_shot(0);
+        restore(ps);
+        return;
+    }
+
+    // Channel 0, low byte and than high byte, mode 3 (square wave)
+#ifndef KONG_HEADLESS
+    asm{
+        MOV AL, 36H
+        OUT 43H, AL
+        MOV AX, WORD PTR pit_divisor
+        OUT 40H, AL
+        MOV AL, AH
+        OUT 40H, AL
+    }
+#endif
+    restore(ps);
+}
+
+// Returns the PIT to the rate of the BIOS (18.2 Hz)
+// and sets the time of the BIOS to the ticks that really passed (the BIOS may have counted the fast ticks)
+void restore_game_clock(){
+    int ps;
+    long bios_ticks;
+
+    disable(ps);
+    clock_tickless = 0;
+#ifndef KONG_HEADLESS
+    asm{
+        MOV AL, 36H
+        OUT 43H, AL
+        XOR AL, AL
+        OUT 40H, AL
+        OUT 40H, AL
+    }
+#endif
+    clock_divisor = 1;
+    clock_divisor_count = 0;
+    bios_ticks = (bios_start_ticks + clock_base_ticks) % BIOS_TICKS_IN_A_DAY;
+    restore(ps);
+
+    biostime(1, bios_ticks);
+}
+
+// Ends the game and goes back to DOS (from the menu or by CTRL+C)
+// The screen, the speaker and the PIT go back to how the game found them
+void exit_game(){
+    // Resets the output to the screen
+    reset_output_to_screen();
+    wipe_entire_screen();
+    set_speaker(0);
+    // The PIT goes back to the rate of the BIOS
+    restore_game_clock();
+#ifndef KONG_HEADLESS
+    // int 27 -> terminate xinu
+    asm INT 27;
+#endif
 }
 
 // Handles the scan codes and ascii codes from the input
@@ -487,11 +1699,13 @@ int scanCode_handler(int scan, int ascii){
     // if the user pressed CTRL+C
     // We want to terminate xinu (int 27 -> terminate xinu)
     if ((scan == 46) && (ascii == 3)){
-        // Resets the output to the screen
-        reset_output_to_screen();
-        wipe_entire_screen();
-        set_speaker(0);
-        asm INT 27;
+        exit_game();
+    }
+
+    // if the user pressed CTRL+R
+    // We want to save the last frames that were printed to a file (the drawer saves it)
+    if ((scan == KEY_R) && (ascii == ASCII_CTRL_R)){
+        frame_history_dump_requested = 1;
     }
     
     // returns the scan code of the key that was pressed
@@ -511,6 +1725,7 @@ INTPROC _int9(int mdevno){
     // if there is a key press we setting ah = 0
     // and calling routine 16
     // after the routine ah = scan code and al = ascii code
+#ifndef KONG_HEADLESS
     asm{
         MOV AH, 1
         INT 16H
@@ -520,13 +1735,18 @@ INTPROC _int9(int mdevno){
         MOV BYTE PTR scan_code, AH
         MOV BYTE PTR ascii_code, AL
     }
+#endif
 
     result = scanCode_handler(scan_code, ascii_code);
 
+    // The game handles the key on the next tick, not on the next deadline
+    update_clock_deadline(1);
+
     // Sends a msg (the msg is the result) to the receiver process
     send(receiver_pid, result);
 
     SKIP_INPUT:
+    ;
 }
 
 // Sets our new routine instead of the old one
@@ -563,62 +1783,52 @@ SYSCALL schedule(int no_of_pids, int cycle_length, int pid1, ...){
     restore(ps);
 }
 
+// Waits for the clock, returns how many ticks passed since the last call
+// (ticks that came while the process was busy are counted by clkint, not lost)
+// can return 0 if a tick came right after the last ticks were taken
+int receive_ticks(){
+    int ps;
+    int pid;
+    int ticks;
+
+    receive();
+
+    disable(ps);
+    pid = getpid();
+    ticks = pending_ticks[pid];
+    pending_ticks[pid] = 0;
+    restore(ps);
+
+    return ticks;
+}
+
 // Keeps track of time
 void time_handler(){
     /* Time keeping vars */
-    // Holds the time diffrences between the last call and the current call of this function
+    // Holds how many ticks passed since the last call of this function
     int deltaTime = 0;
-    // The msg the was recieved
-    int received_msg;
-
-    int i = 0;
 
     while(TRUE){
         // Waiting for the time routine to wake up this process
         // Basically waiting for a tick to pass
-        received_msg = receive();
+        deltaTime = receive_ticks();
 
         // if the game is in game and the game is ready for play
         if (gameState == InGame && game_init){
             /* Time tracking */
-            // delta time is the measurement of the time between calls
-            deltaTime = elapsed_time - time_handler_last_call;
             // delta time counter is the counter of how many ticks passed
             deltaTime_counter += deltaTime;
             // Saving the counter to global use
             clock_ticks = deltaTime_counter;
-            // saving the last call of the updater to measure the delta time
-            time_handler_last_call = elapsed_time;
-
-            // Updating the timer of the gravity
-            gravity_ticks -= deltaTime;
-            // Updating the timer of the spawning of barrels
-            spawn_barrel_timer -= deltaTime;
-
-            // if it's not the first level
-            if (game_level > 1){
-                // Updating the timer of the spawning of falling barrels
-                spawn_falling_barrel_timer -= deltaTime;
-            }
 
-            // Updating the timers of all the barrel's movement
-            for (i = 0; i < MAX_BARRELS_OBJECT; i++){
-                // if the barrel exists
-                if (barrels_array[i]){
-                    barrels_array[i]->movement_ticks -= deltaTime;
-                    // if it's not the first level
-                    if (game_level > 1){
-                        // if it's a falling barrel, update it's falling timer
-                        if (barrels_array[i]->is_falling_barrel){
-                            barrels_array[i]->falling_ticks -= deltaTime;
-                        }
-                    }
-                }
-            }
+            // The timers of the game are in the timer wheel, they go by the time of the simulation (game_time)
 
             // Checks if a second has passed
-            if (deltaTime_counter >= TICKS_IN_A_SECOND){
+            // (a message can bring more than one tick, so more than one second can pass)
+            while (deltaTime_counter >= TICKS_IN_A_SECOND){
                 clock_seconds++;
+                advance_clock_text();
+                invalidate_widget(&clock_widget);
                 // if the player is playing the game
                 // every second add points to his score for survival
                 if (gameState == InGame && game_init) add_score_points(POINTS_EVERY_SEC);
@@ -638,36 +1848,260 @@ void time_handler(){
                     if (gameState == InGame && game_init) add_score_points(POINTS_EVERY_MINUTE);
                 }
 
-                // We want every second to reset the counter
-                deltaTime_counter = 0;
-                // Resetting the global ticks counter
-                clock_ticks = 0;
+                // Every second is taken from the counter, the ticks after it are kept for the next one
+                deltaTime_counter -= TICKS_IN_A_SECOND;
+                // The global ticks counter goes with it
+                clock_ticks = deltaTime_counter;
             }
         }
     }
 }
 
+// Prints the published frame, if there is one
+void drawer_print_frame(){
+    int ps;
+
+    // Taking the published frame, so the updater wont draw into it while we print it
+    disable(ps);
+    // Nothing new to print
+    if (!frame_pending){
+        restore(ps);
+        return;
+    }
+    frame_pending = 0;
+    frame_printing = 1;
+    restore(ps);
+
+    // (print_to_screen lets go of the frame before it waits to show it)
+    print_to_screen();
+}
+
 // Handles the drawing to the 'screen'
 void drawer(){
+
     while (TRUE){
-        receive();
+        receive_ticks();
         // if the game was exited we dont want to keep drawing to the screen
         if (game_exited) continue;
-        print_to_screen();
+
+        // The user asked for the frame history
+        if (frame_history_dump_requested){
+            frame_history_dump_requested = 0;
+            dump_frame_history();
+        }
+
+        drawer_print_frame();
+    }
+}
+
+// Empties the timer wheel, the time of the wheel is now
+void reset_timer_wheel(){
+    int i = 0;
+
+    for (i = 0; i < TIMER_WHEEL_SLOTS; i++){
+        timer_wheel[i] = -1;
+    }
+
+    for (i = 0; i < TIMERS_COUNT; i++){
+        timer_is_scheduled[i] = 0;
+        timer_fired[i] = 0;
+    }
+
+    timer_wheel_time = game_time;
+}
+
+// Takes the timer out of the slot it's in
+void unlink_timer(int timer){
+    int* link = &timer_wheel[timer_due_time[timer] & (TIMER_WHEEL_SLOTS - 1)];
+
+    while (*link != timer) link = &timer_next[*link];
+    *link = timer_next[timer];
+    timer_is_scheduled[timer] = 0;
+}
+
+// Sets the timer to fire in ticks (from the time of the game)
+// A timer that is set again is moved, it fires only once
+void schedule_timer(int timer, int ticks){
+    int slot;
+
+    if (timer_is_scheduled[timer]) unlink_timer(timer);
+    timer_fired[timer] = 0;
+
+    timer_due_time[timer] = game_time + ticks;
+    // The wheel already got there, it fires right away
+    if (TIME_REACHED(timer_wheel_time, timer_due_time[timer])){
+        timer_fired[timer] = 1;
+        return;
+    }
+
+    slot = timer_due_time[timer] & (TIMER_WHEEL_SLOTS - 1);
+    timer_next[timer] = timer_wheel[slot];
+    timer_wheel[slot] = timer;
+    timer_is_scheduled[timer] = 1;
+}
+
+// Moves the wheel until the time of the game, firing the timers that are due
+// A slot holds the timers of a few turns of the wheel, only the due ones fire
+void advance_timer_wheel(){
+    int timer;
+    int next;
+
+    while (TICKS_BETWEEN(timer_wheel_time, game_time) > 0){
+        timer_wheel_time++;
+
+        for (timer = timer_wheel[timer_wheel_time & (TIMER_WHEEL_SLOTS - 1)]; timer >= 0; timer = next){
+            next = timer_next[timer];
+            if (TIME_REACHED(timer_wheel_time, timer_due_time[timer])){
+                unlink_timer(timer);
+                timer_fired[timer] = 1;
+            }
+        }
+    }
+}
+
+// Returns 1 if the timer fired since the last time we asked
+int take_timer_fired(int timer){
+    if (!timer_fired[timer]) return 0;
+
+    timer_fired[timer] = 0;
+    return 1;
+}
+
+// Returns how many ticks left until the timer fires (0 = fired or not set)
+int timer_ticks_left(int timer){
+    if (!timer_is_scheduled[timer]) return 0;
+
+    return TICKS_BETWEEN(game_time, timer_due_time[timer]);
+}
+
+// Returns the row of the barrels index the barrel belongs to
+int get_barrel_index_row(int index_in_array){
+    int row = barrel_y[index_in_array];
+
+    if (row < 0) row = 0;
+    if (row >= SCREEN_HEIGHT) row = SCREEN_HEIGHT - 1;
+
+    return row;
+}
+
+// Adds the barrel to the end of the list of the row
+void add_barrel_to_row(int index_in_array, int row){
+    barrel_index_row[index_in_array] = row;
+    barrel_index_slot[index_in_array] = barrels_row_count[row];
+    row_barrels[row][barrels_row_count[row]] = index_in_array;
+    barrels_row_count[row]++;
+}
+
+// Takes the barrel out of the list of it's row
+// The last barrel of the row is moved to it's place
+void remove_barrel_from_row(int index_in_array){
+    int row = barrel_index_row[index_in_array];
+    int slot = barrel_index_slot[index_in_array];
+    int moved;
+
+    barrels_row_count[row]--;
+    moved = row_barrels[row][barrels_row_count[row]];
+    row_barrels[row][slot] = moved;
+    barrel_index_slot[moved] = slot;
+}
+
+// Puts the barrel in the row of the barrels index it belongs to
+void index_barrel(int index_in_array){
+    add_barrel_to_row(index_in_array, get_barrel_index_row(index_in_array));
+}
+
+// Moves the barrel to the row of the barrels index it's in now
+// Called after the barrel moved
+void reindex_barrel(int index_in_array){
+    int row = get_barrel_index_row(index_in_array);
+
+    if (row == barrel_index_row[index_in_array]) return;
+
+    remove_barrel_from_row(index_in_array);
+    add_barrel_to_row(index_in_array, row);
+}
+
+// Takes the barrels in the rows the box [y, y + height) can touch from the barrels index into near_barrels
+// (a barrel that starts above the box can reach it's rows)
+// Returns how many barrels were taken
+int gather_barrels_near_box(int y, int height){
+    int count = 0;
+    int row;
+    int slot;
+    int first_row = y - BARREL_HEIGHT + 1;
+    int last_row = y + height - 1;
+
+    if (first_row < 0) first_row = 0;
+    if (last_row >= SCREEN_HEIGHT) last_row = SCREEN_HEIGHT - 1;
+
+    for (row = first_row; row <= last_row; row++){
+        for (slot = 0; slot < barrels_row_count[row]; slot++){
+            near_barrels[count++] = row_barrels[row][slot];
+        }
+    }
+
+    return count;
+}
+
+// Tests the box against the barrels in near_barrels, the result of every one is saved in near_barrel_hits (1 = collided)
+// The loop has no branches (every test is a compare that gives 0 or 1), so a compiler can test a few barrels at once
+// Returns how many barrels collided with the box
+int collide_box_with_barrels(int x, int y, int width, int height, int near_count){
+    int k = 0;
+    int i;
+    int hits_count = 0;
+    int right = x + width;
+    int bottom = y + height;
+
+    for (k = 0; k < near_count; k++){
+        i = near_barrels[k];
+        near_barrel_hits[k] = (barrel_x[i] < right) & (x < barrel_x[i] + BARREL_WIDTH) &
+        (barrel_y[i] < bottom) & (y < barrel_y[i] + BARREL_HEIGHT);
+        hits_count += near_barrel_hits[k];
     }
+
+    return hits_count;
+}
+
+// Tests the game object against the barrels, the result of every barrel is saved in hits (1 = collided)
+// The barrels index limits the test to the barrels in the rows of the object, so it does not grow with all the barrels
+// Returns how many barrels collided with the object (if 0, hits may not be filled)
+int collide_object_with_barrels(gameObject* obj, char* hits){
+    int i;
+    int k;
+    int near_count = gather_barrels_near_box(obj->top_left_point.y, obj->height);
+    int hits_count = collide_box_with_barrels(obj->top_left_point.x, obj->top_left_point.y, obj->width, obj->height, near_count);
+
+    if (hits_count == 0) return 0;
+
+    // A hit is rare (the barrel is gone or the player is hurt), only than all the hits are filled
+    for (i = 0; i < barrels_count; i++) hits[i] = 0;
+    for (k = 0; k < near_count; k++) hits[near_barrels[k]] = near_barrel_hits[k];
+
+    return hits_count;
 }
 
 // Deletes a barrel from the game
-// frees it's memory and stuff
+// The last barrel is moved to it's place so the barrels stay packed
+// (a loop that deletes barrels while going through them should go from the last one)
 void delete_barrel(int index_in_array){
-    barrel* barrelToDelete = barrels_array[index_in_array];
+    int last = barrels_count - 1;
 
-    // Setting the index to be free so we can spawn more barrels
-    barrels_array[index_in_array] = NULL;
+    remove_barrel_from_row(index_in_array);
+    // The last barrel is in the index by it's index, it gets the new one
+    if (last != index_in_array) row_barrels[barrel_index_row[last]][barrel_index_slot[last]] = index_in_array;
 
-    // First freeing the gameobject memory than the barrel
-    freemem(barrelToDelete->obj, sizeof(struct GameObject));
-    freemem(barrelToDelete, sizeof(struct Barrel));
+    barrel_x[index_in_array] = barrel_x[last];
+    barrel_y[index_in_array] = barrel_y[last];
+    barrel_move_time[index_in_array] = barrel_move_time[last];
+    barrel_is_grounded[index_in_array] = barrel_is_grounded[last];
+    barrel_movement_direction[index_in_array] = barrel_movement_direction[last];
+    barrel_is_falling[index_in_array] = barrel_is_falling[last];
+    barrel_fall_time[index_in_array] = barrel_fall_time[last];
+    barrel_trajectory_step[index_in_array] = barrel_trajectory_step[last];
+    barrel_index_row[index_in_array] = barrel_index_row[last];
+    barrel_index_slot[index_in_array] = barrel_index_slot[last];
+    barrels_count--;
 }
 
 // Checks a collision between 2 game objects
@@ -707,49 +2141,73 @@ int check_collision_with_rectangle(gameObject* obj_a, gameObject* obj_b){
     return 0;
 }
 
-// Checks if there is a collision between the gameobject and the barrel in index_in_array
-void check_collision_with_a_barrel(gameObject* obj, int index_in_array){
-    // Taking the top left point of the model of the game object
-    position top_left = obj->top_left_point;
+// Handles a barrel that collided with the game object
+void handle_barrel_collision(gameObject* obj, int index_in_array){
+    // Play a sound to indicate there was a collision with a barrel
+    send_sound(SOUND_BARREL_HIT_FREQ);
+    // Delete the barrel we just hitted
+    delete_barrel(index_in_array);
 
-    // Getting the dimensions of the game object's model
-    int model_height = obj->height;
-    int model_width = obj->width;
+    // if the game object is the player
+    // Decrease his lives
+    if (obj->flags & OBJECT_HURT_BY_BARRELS)
+        sub_player_life();
+}
 
-    // Getting the position and size of the barrel
-    barrel* barrel = barrels_array[index_in_array];
-    int barrel_x = barrel->obj->top_left_point.x;
-    int barrel_y = barrel->obj->top_left_point.y;
-    int barrel_height = barrel->obj->height;
-    int barrel_width = barrel->obj->width;
-    
-    // Calculating edges for the first rectangle
-    int obj_right = top_left.x + model_width - 1;
-    int obj_left = top_left.x;
-    int obj_top = top_left.y;
-    int obj_bottom = top_left.y + model_height - 1;
+// Returns 1 if there is a tile of the kind in the cells [x, x + width) of the row
+// There are no tiles outside of the screen
+int row_has_tile(int kind, int y, int x, int width){
+    unsigned int* words;
+    unsigned int mask;
+    int end;
 
-    // Calculating edges for the second rectangle
-    int b_right = barrel_x + barrel_width - 1;
-    int b_left = barrel_x;
-    int b_top = barrel_y;
-    int b_bottom = barrel_y + barrel_height - 1;
+    if (y < 0 || y >= SCREEN_HEIGHT) return 0;
 
-    // Checks for collision between 2 rectangles
-    if (obj_right >= b_left && obj_left <= b_right && obj_bottom >= b_top && obj_top <= b_bottom){
-        // if we are here there was a collision with a barrel
+    // Clipping the cells to the screen
+    if (x < 0){
+        width += x;
+        x = 0;
+    }
+    if (x + width > SCREEN_WIDTH) width = SCREEN_WIDTH - x;
+    if (width <= 0) return 0;
 
-        // Play a sound to indicate there was a collision with a barrel
-        send_sound(SOUND_BARREL_HIT_FREQ);
-        // Delete the barrel we just hitted
-        delete_barrel(index_in_array);
-        
-        // if the game object is the player
-        // Decrease his lives
-        if (strstr(obj->label, "Player"))
-            sub_player_life();
+    words = tile_rows[kind][y];
+    end = x + width;
+
+    // Checking the cells word by word
+    while (x < end){
+        // The cells from x to the end of the word
+        mask = (unsigned int) 0xFFFF << (x & 15);
+        // The cells end inside this word
+        if ((x | 15) >= end) mask &= (unsigned int) 0xFFFF >> (15 - ((end - 1) & 15));
+
+        if (words[x >> 4] & mask) return 1;
+
+        // The start of the next word
+        x = (x | 15) + 1;
+    }
+
+    return 0;
+}
+
+// Returns 1 if there is a tile of the kind in the cells [y, y + height) of the column
+// There are no tiles outside of the screen
+int column_has_tile(int kind, int x, int y, int height){
+    unsigned long mask;
+
+    if (x < 0 || x >= SCREEN_WIDTH) return 0;
+
+    // Clipping the cells to the screen
+    if (y < 0){
+        height += y;
+        y = 0;
     }
+    if (y + height > SCREEN_HEIGHT) height = SCREEN_HEIGHT - y;
+    if (height <= 0) return 0;
 
+    mask = ((1UL << height) - 1) << y;
+
+    return (tile_columns[kind][x] & mask) != 0;
 }
 
 // Checks for collisions inside the game object model
@@ -764,30 +2222,19 @@ int check_collision_with_ladder(gameObject* obj, int below){
     int model_width = obj->width;
 
     int i = 0;
-    int j = 0;
-    char currentLadderPixel;
 
     // if we want to check inside the player model
     if (!below){
-        // looping from the top left point to the right bottom point
-        // and checking for collisions
-        for (i = top_left.y; i < top_left.y + model_height; i++){
-            for (j = top_left.x; j < top_left.x + model_width; j++){
-                if (ladder_map_ptr != NULL){
-                    if (ladder_map_ptr[i * SCREEN_WIDTH + j] == '_') return 1;
-                }
-            }
-        }
-    }else {
-        // Check all the pixels below the objects model
+        // Checking every column of the model for the middle of a ladder
         for (i = top_left.x; i < top_left.x + model_width; i++){
-            // Getting the current pixel in the ladders matrix
-            currentLadderPixel = ladder_map_ptr[(top_left.y + model_height) * SCREEN_WIDTH + i];
-            if (currentLadderPixel == '_' || currentLadderPixel == '|') return 1;
+            if (column_has_tile(TILE_LADDER_RUNG, i, top_left.y, model_height)) return 1;
         }
+
+        return 0;
     }
 
-    return 0;
+    // Check all the pixels below the objects model
+    return row_has_tile(TILE_LADDER, top_left.y + model_height, top_left.x, model_width);
 }
 
 // Checks for collisions
@@ -806,9 +2253,6 @@ int check_collision_with_map(gameObject* obj, int x_movement, int y_movement){
     int check_pos_x = top_left.x;
     int check_pos_y = top_left.y;
 
-    int i = 0;
-    char currentLadderPixel;
-
     // if we have any movement on the x axis
     if (x_movement != 0){
         // Assuming that the x movement is to the left (negative)
@@ -817,14 +2261,10 @@ int check_collision_with_map(gameObject* obj, int x_movement, int y_movement){
         // add the width of the model of the game object plus 1 (because we subtracted it)
         if (x_movement > 0) check_pos_x += model_width + 1;
 
-
         // We want to check the pixels to the right/left of the model
         // meaning if the model height is 3, we need to check 3 pixels to the right/left
         // of the model for collision
-        for (i = top_left.y; i < top_left.y + model_height; i++){
-            // Check for collision with the map elements
-            if (map_1[i][check_pos_x] == 'z' || map_1[i][check_pos_x] == 'Z') return 0;
-        }
+        if (column_has_tile(TILE_SOLID, check_pos_x, top_left.y, model_height)) return 0;
     }
 
     // if we have any movement on the y axis
@@ -838,10 +2278,7 @@ int check_collision_with_map(gameObject* obj, int x_movement, int y_movement){
         // We want to check the pixels up/down of the model
         // meaning if the model width is 2, we need to check 2 pixels above/below
         // of the model for collision
-        for (i = top_left.x; i < top_left.x + model_width; i++){
-            // Check for collision with the map elements
-            if (map_1[check_pos_y][i] == 'z' || map_1[check_pos_y][i] == 'Z') return 0;
-        }
+        if (row_has_tile(TILE_SOLID, check_pos_y, top_left.x, model_width)) return 0;
     }
 
     // if we dont have any collisions we can move
@@ -855,66 +2292,21 @@ void add_to_object_position(gameObject* obj, int x_movement, int y_movement){
     (obj->top_left_point).y += y_movement;
 }
 
-// Spawns the hammer at one of the first 3 platform (NOT ON KONG PLATFORM)
+// Spawns the hammer on one of the hammer platforms of the level (NOT ON KONG PLATFORM)
 void spawn_hammer(){
-    // Rough est.
-    // First platform: X: [22,57] Y: 22
-    // Second platform: X: [22,53] Y: 17
-    // Third platform: X: [28,57] Y: 12
-
-    int rnd_x;
-    int rnd_y;
-    int rnd_platform;
-    int platform_choices = 3;
-    int num_of_platforms = 3;
-    int offset = 1;
-
-    // We want to get the player's feet level
-    int player_y = playerObject.top_left_point.y + playerObject.height - 1;
+    const hammerPlatform* platform;
 
     // if the player has the hammer or the hammer exist on the map
     // we dont want to spawn it again
     if (is_with_hammer || is_hammer_exist) return;
-    
-    // if the player is on the first platform
-    if (player_y <= 22 + offset){
-        platform_choices = 3;
-    }else if (player_y <= 17 + offset){
-        // second platform
-        platform_choices = 2;
-    }else if (player_y <= 12 + offset){
-        // thrid platform
-        platform_choices = 1;
-    }
-
-    // Randomly select the platform to spawn the hammer on
-    rnd_platform = rand() % platform_choices + 1;
-
-    hammerObject.top_left_point.x = 0;
-    hammerObject.top_left_point.y = 0;
-
-    // Based on what platform we got to spawn the hammer on
-    // Randmoly select x pos to spawn on
-    switch(rnd_platform){
-        case 1:
-            rnd_x = RAND_2(57, 22);
-            rnd_y = 22;
-        break;
-
-        case 2:
-            rnd_x = RAND_2(53, 22);
-            rnd_y = 17;
-        break;
-
-        case 3:
-            rnd_x = RAND_2(57, 28);
-            rnd_y = 12;
-        break;
-    }
+
+    // Randomly select the platform to spawn the hammer on (one of the platforms of the level)
+    platform = &current_level->hammer_platforms[rand() % current_level->hammer_platforms_count];
 
     // Sets the position of the hammer to the spawn point
-    hammerObject.top_left_point.x = rnd_x;
-    hammerObject.top_left_point.y = rnd_y;
+    // Randmoly select x pos on the platform
+    hammerObject->top_left_point.x = RAND_2(platform->x_max, platform->x_min);
+    hammerObject->top_left_point.y = platform->y;
     // Telling the game there is a hammer on the map
     is_hammer_exist = 1;
     // Set the hammer hits to the default (4)
@@ -939,13 +2331,13 @@ void set_hammer_player_position(){
 
     // if the player is look to the right
     if (player_movement_direction == 1){
-        hammerObject.top_left_point.x = playerObject.top_left_point.x + 3;
+        hammerObject->top_left_point.x = playerObject->top_left_point.x + 3;
     }else {
         // if the player is looking to the left
-        hammerObject.top_left_point.x = playerObject.top_left_point.x - 2;
+        hammerObject->top_left_point.x = playerObject->top_left_point.x - 2;
     }
     // The position of the hammer is in the middle of the player's model (talking about height)
-    hammerObject.top_left_point.y = playerObject.top_left_point.y + 1;
+    hammerObject->top_left_point.y = playerObject->top_left_point.y + 1;
 }
 
 // Movement with collisions
@@ -965,7 +2357,7 @@ void move_object(gameObject* obj, int x_movement, int y_movement){
     // if the player has the hammer, than make it walk with it
     // just setting the position of the hammer to the position of the player
     // we gives the hammer time to draw the 'hit' so that's why we got a timer here
-    if (is_with_hammer && (elapsed_time - hammer_hit_duration) >= HAMMER_DURATION_IN_TICKS){
+    if (is_with_hammer && TICKS_BETWEEN(hammer_hit_duration, game_time) >= HAMMER_DURATION_IN_TICKS){
         set_hammer_player_position();
     }
 
@@ -973,7 +2365,7 @@ void move_object(gameObject* obj, int x_movement, int y_movement){
     // and the object is the player
     // annddd the player is on a ladder
     // we want a different movement... ladder movement!
-    if (y_movement != 0 && strstr(obj->label, "Player") && on_top_ladder){
+    if (y_movement != 0 && (obj->flags & OBJECT_CLIMBS) && on_top_ladder){
         // if we got a down movement
         if (y_movement > 0){
             // Checks for ladders
@@ -986,311 +2378,797 @@ void move_object(gameObject* obj, int x_movement, int y_movement){
             if (check_movement_ladder_inside && check_movement_map){
                 add_to_object_position(obj, x_movement, y_movement);            
             }else {
-                // if the player is not colliding with a ladder
-                // or he is colliding with the map
-                // and if there is a ladder below him -> we can move
-                if (check_movement_ladder_below)
-                    add_to_object_position(obj, x_movement, y_movement);
+                // if the player is not colliding with a ladder
+                // or he is colliding with the map
+                // and if there is a ladder below him -> we can move
+                if (check_movement_ladder_below)
+                    add_to_object_position(obj, x_movement, y_movement);
+            }
+        }else {
+            // if the movement is up we dont fancy calculations
+            add_to_object_position(obj, x_movement, y_movement);
+        }
+    }else {
+        // If the new movement is valid (1 = no collisions)
+        if (check_movement_map){
+            add_to_object_position(obj, x_movement, y_movement);
+        }
+    }
+}
+
+// Makes the hammer hit!
+// The barrels it hits are checked in the barrels step (step_barrels)
+void hammer_hit(){
+    // Move the hammer for the hit
+    move_object(hammerObject, 0, 1);
+    // Setting the start of the hit
+    hammer_hit_duration = game_time;
+    is_hammer_striking = 1;
+}
+
+// Handles a barrel that the hammer hit
+void handle_hammer_hit_barrel(int index_in_array){
+    // Playing a sound to indicate that the hammer hit a barrel
+    send_sound(SOUND_HAMMER_HIT_FREQ);
+    // Delete the barrel
+    delete_barrel(index_in_array);
+    // Decrease the hammer hits that is left
+    hammer_hits_left--;
+    // Adds points to the player for destroying the barrel
+    add_score_points(POINTS_BARREL_HIT);
+    // if we ran out of hits, spawn a new hammer
+    if (hammer_hits_left <= 0){
+        reset_hammer();
+        // The new hammer is not in the hit
+        is_hammer_striking = 0;
+    }
+}
+
+// Makes the player jump
+void player_jump(){
+    // Checks if the player is grounded
+    if (!check_collision_with_map(playerObject, 0, 1)){
+        // Try to move the player up
+        move_object(playerObject, 0, -1);
+        // Set the duration if the air, so we have some air time
+        air_duration_elapsed = game_time;
+    }
+}
+
+// Returns 1 if the barrel is on a platform
+int is_barrel_grounded(int index_in_array){
+    return row_has_tile(TILE_SOLID, barrel_y[index_in_array] + BARREL_HEIGHT, barrel_x[index_in_array], BARREL_WIDTH);
+}
+
+// Returns 1 if some of the barrel is inside the screen
+int is_barrel_in_screen(int index_in_array){
+    return barrel_x[index_in_array] + BARREL_WIDTH > 0 && barrel_x[index_in_array] < SCREEN_WIDTH &&
+    barrel_y[index_in_array] + BARREL_HEIGHT > 0 && barrel_y[index_in_array] < SCREEN_HEIGHT;
+}
+
+// Returns the slot of the trajectory index the position is in
+int get_trajectory_index_slot(int x, int y){
+    return (unsigned int) (y * SCREEN_WIDTH + x) & (TRAJECTORY_INDEX_SLOTS - 1);
+}
+
+// Indexes the grounded steps of the barrels trajectory by their position
+void index_barrel_trajectory(){
+    int i = 0;
+    int slot;
+
+    for (i = 0; i < TRAJECTORY_INDEX_SLOTS; i++){
+        trajectory_index[i] = -1;
+    }
+
+    // From the last step, so every slot ends up in the order of the path
+    for (i = barrel_trajectory_length - 1; i >= 0; i--){
+        if (!barrel_trajectory[i].is_grounded) continue;
+
+        slot = get_trajectory_index_slot(barrel_trajectory[i].x, barrel_trajectory[i].y);
+        trajectory_index_next[i] = trajectory_index[slot];
+        trajectory_index[slot] = i;
+    }
+}
+
+// Builds the path of a barrel that is spawned at (x,y), by moving it on the tiles of the level
+// the same way the map moves it: roll while on a platform, fall when not,
+// and change the direction the first time it falls off a platform
+void build_barrel_trajectory(int x, int y){
+    trajectoryStep* step;
+    int direction = 1;
+    // A new barrel starts as grounded
+    int was_grounded = 1;
+    int is_grounded;
+
+    barrel_trajectory_length = 0;
+
+    while (barrel_trajectory_length < MAX_TRAJECTORY_STEPS){
+        is_grounded = row_has_tile(TILE_SOLID, y + BARREL_HEIGHT, x, BARREL_WIDTH);
+        // Fell off the platform
+        if (!is_grounded && was_grounded) direction *= -1;
+        was_grounded = is_grounded;
+
+        step = &barrel_trajectory[barrel_trajectory_length];
+        step->x = x;
+        step->y = y;
+        step->is_grounded = is_grounded;
+        step->movement_direction = direction;
+        barrel_trajectory_length++;
+
+        // The barrel left the screen, it will be deleted here
+        if (x + BARREL_WIDTH <= 0 || x >= SCREEN_WIDTH || y >= SCREEN_HEIGHT) break;
+
+        if (is_grounded){
+            // Something blocks the barrel, it stays here
+            if (direction > 0 && column_has_tile(TILE_SOLID, x + BARREL_WIDTH, y, BARREL_HEIGHT)) break;
+            if (direction < 0 && column_has_tile(TILE_SOLID, x - 1, y, BARREL_HEIGHT)) break;
+            x += direction;
+        }else {
+            y++;
+        }
+    }
+
+    index_barrel_trajectory();
+}
+
+// Returns the first step of the barrels trajectory that is at (x,y), grounded and rolls to the direction
+// Returns -1 if the trajectory never gets there
+int find_barrel_trajectory_step(int x, int y, int direction){
+    int i;
+
+    for (i = trajectory_index[get_trajectory_index_slot(x, y)]; i >= 0; i = trajectory_index_next[i]){
+        if (barrel_trajectory[i].x == x && barrel_trajectory[i].y == y &&
+        barrel_trajectory[i].movement_direction == direction) return i;
+    }
+
+    return -1;
+}
+
+// Puts the barrel on the step of the barrels trajectory
+void set_barrel_trajectory_step(int index_in_array, int step_index){
+    trajectoryStep* step = &barrel_trajectory[step_index];
+
+    barrel_trajectory_step[index_in_array] = step_index;
+    barrel_x[index_in_array] = step->x;
+    barrel_y[index_in_array] = step->y;
+    barrel_is_grounded[index_in_array] = step->is_grounded;
+    barrel_movement_direction[index_in_array] = step->movement_direction;
+}
+
+// Moves the barrel to the next step of the barrels trajectory
+// At the end of the trajectory (the path was longer than MAX_TRAJECTORY_STEPS, or the barrel is stuck)
+// the barrel goes back to be moved by the map
+void advance_barrel_trajectory(int index_in_array){
+    int next_step = barrel_trajectory_step[index_in_array] + 1;
+
+    if (next_step < barrel_trajectory_length) set_barrel_trajectory_step(index_in_array, next_step);
+    else barrel_trajectory_step[index_in_array] = -1;
+}
+
+// Moves the barrel in the map (when it's movement timer is done)
+// The barrels are not in the timer wheel on purpose, their times are checked one by one:
+// step_barrels goes over all of them every step anyway (gravity, leaving the screen, the hits and drawing)
+// and a deleted barrel moves another one to it's index, so a timer of a barrel would have to follow it
+void move_barrel(int i){
+    // The column the barrel rolls into
+    int next_column;
+
+    // if it's time to move the barrel
+    if (TIME_REACHED(game_time, barrel_move_time[i])) {
+        // When to move the barrel next
+        barrel_move_time[i] = game_time + barrel_movement_speed_in_ticks;
+
+        // A barrel that is not on the trajectory (a falling barrel that dropped) landed on a platform
+        // if the trajectory gets here, the barrel goes back to it
+        if (barrel_trajectory_step[i] < 0 && is_barrel_grounded(i)){
+            barrel_trajectory_step[i] = find_barrel_trajectory_step(barrel_x[i], barrel_y[i], barrel_movement_direction[i]);
+        }
+
+        if (barrel_trajectory_step[i] >= 0){
+            // The barrel rolls only on a platform (the falls are done by the gravity)
+            if (barrel_trajectory[barrel_trajectory_step[i]].is_grounded) advance_barrel_trajectory(i);
+        }
+
+        // A barrel that is not on the trajectory (or got to the end of it) is moved by the map
+        if (barrel_trajectory_step[i] < 0){
+            if (is_barrel_grounded(i)){
+                // if the barrel in on the platform (grounded)
+                // we want a movement on the x axis only if the barrel is grounded
+                // The barrel is grounded
+                barrel_is_grounded[i] = 1;
+                // Try to move the barrel to the movement direction
+                if (barrel_movement_direction[i] > 0) next_column = barrel_x[i] + BARREL_WIDTH;
+                else next_column = barrel_x[i] - 1;
+                if (!column_has_tile(TILE_SOLID, next_column, barrel_y[i], BARREL_HEIGHT)){
+                    barrel_x[i] += barrel_movement_direction[i];
+                }
+            }else {
+                // if the barrel was on top of a platform
+                // and now it's falling, we want to change the direction of movement
+                if (barrel_is_grounded[i]){
+                    // Now the barrel is falling
+                    barrel_is_grounded[i] = 0;
+                    // Changing the direction of the barrel (to make to zig zag movement)
+                    barrel_movement_direction[i] *= -1;
+                }
             }
-        }else {
-            // if the movement is up we dont fancy calculations
-            add_to_object_position(obj, x_movement, y_movement);
         }
-    }else {
-        // If the new movement is valid (1 = no collisions)
-        if (check_movement_map){
-            add_to_object_position(obj, x_movement, y_movement);
+    }
+
+    // if the barrel is a falling barrel
+    if (barrel_is_falling[i]){
+        // if it's time for the barrel to fall and the barrel in on the ground
+        if (TIME_REACHED(game_time, barrel_fall_time[i]) && barrel_is_grounded[i]){
+            // The barrel is not on the ground (because it's falling.... dah)
+            barrel_is_grounded[i] = 0;
+            // Changing the direction of the movement
+            barrel_movement_direction[i] *= -1;
+            // Drop the barrel one cell down
+            // Because right now the barrel in on top of a platform and we want it to fall
+            // the trajectory does not go through the platform, the map moves the barrel until it lands
+            barrel_trajectory_step[i] = -1;
+            barrel_y[i]++;
+            // Sets a new timer 'randomly'
+            barrel_fall_time[i] = game_time + rand() % (FALLING_BARREL_MAX_FALL + 1) + spawn_falling_barrel_speed_in_ticks;
         }
     }
 }
 
-// Makes the hammer hit!
-void hammer_hit(){
+// Apply gravity to the barrel
+void apply_gravity_to_barrel(int i){
+    if (barrel_trajectory_step[i] >= 0){
+        // On the trajectory the barrel falls only when it's not on a platform
+        if (!barrel_trajectory[barrel_trajectory_step[i]].is_grounded) advance_barrel_trajectory(i);
+        // if the barrel got to the end of the trajectory, the map moves it from there
+        if (barrel_trajectory_step[i] >= 0) return;
+    }
+
+    if (!is_barrel_grounded(i)){
+        // Move the barrel down
+        barrel_y[i]++;
+    }
+}
+
+// Apply gravity to all the game objects (the barrels get it in their step)
+void apply_gravity_to_game_objects(){
     int i = 0;
+    gameObject* obj;
 
-    // Move the hammer for the hit
-    move_object(&hammerObject, 0, 1);
-    // Setting the start of the hit
-    hammer_hit_duration = elapsed_time;
-    // Check for collision with the barrels
-    for (i = 0; i < MAX_BARRELS_OBJECT; i++){
-        if (barrels_array[i]){
-            if (check_collision_with_rectangle(&hammerObject, barrels_array[i]->obj)){
-                // Playing a sound to indicate that the hammer hit a barrel
-                send_sound(SOUND_HAMMER_HIT_FREQ);
-                // Delete the barrel
-                delete_barrel(i);
-                // Decrease the hammer hits that is left
-                hammer_hits_left--;
-                // Adds points to the player for destroying the barrel
-                add_score_points(POINTS_BARREL_HIT);
-                // if we ran out of hits, spawn a new hammer
-                if (hammer_hits_left <= 0){
-                    reset_hammer();
+    for (i = 0; i < MAX_ENTITIES; i++){
+        obj = &entities[i];
+        if (!(obj->flags & OBJECT_ACTIVE)) continue;
+
+        switch (obj->kind){
+            case KindPlayer:
+                // if the player is not on a ladder
+                // and if it's time to try to apply gravity to the player
+                // (we give the player some air time so we have the effect of a fall)
+                if (!on_top_ladder && TICKS_BETWEEN(air_duration_elapsed, game_time) >= JUMP_DURATION_IN_TICKS){
+                    // Try to move the player down
+                    move_object(obj, 0, 1);
                 }
-            }
+            break;
+
+            default:
+            break;
         }
     }
 }
 
-// Makes the player jump
-void player_jump(){
-    // Checks if the player is grounded
-    if (!check_collision_with_map(&playerObject, 0, 1)){
-        // Try to move the player up
-        move_object(&playerObject, 0, -1);
-        // Set the duration if the air, so we have some air time
-        air_duration_elapsed = elapsed_time;
+// Unpacks a screen from maps.h (see there how it's packed) into the screen buffer
+void unpack_screen(const unsigned char* packed, char* screen){
+    int cell = 0;
+    int count;
+
+    while (cell < SCREEN_SIZE){
+        count = *packed & 0x7F;
+
+        if (*packed & 0x80){
+            // A run of the same char
+            packed++;
+            while (count-- > 0) screen[cell++] = *packed;
+            packed++;
+        }else {
+            // Chars that are copied as they are
+            packed++;
+            while (count-- > 0) screen[cell++] = *packed++;
+        }
     }
 }
 
-// Moves all the barrels in the map
-void move_barrels(){
+// Inserts the ladders of the level to the background
+// level - the level num
+void insert_ladders_to_background(int level){
     int i = 0;
-    // Holds the current barrel that we work with
-    barrel* barrel;
-
-    for (i = 0; i < MAX_BARRELS_OBJECT; i++){
-        // if the barrel exist
-        if (barrels_array[i]){
-            // if the barrel game object exists
-            if (barrels_array[i]->obj){
-                barrel = barrels_array[i];
-                // if it's time to move the barrel, end of timer
-                if (barrel->movement_ticks <= 0) {
-                    // Resetting the barrel's movement timer
-                    barrel->movement_ticks = barrel_movement_speed_in_ticks;
-                    // if the barrel in on the platform (grounded)
-                    // we want a movement on the x axis only if the barrel is grounded
-                    if (!check_collision_with_map(barrel->obj, 0, 1)){
-                        // The barrel is grounded
-                        barrel->is_grounded = 1;
-                        // Try to move the barrel to the movement direction
-                        move_object(barrel->obj, barrel->movement_direction, 0);
-                    }else {
-                        // if the barrel was on top of a platform
-                        // and now it's falling, we want to change the direction of movement
-                        if (barrel->is_grounded){
-                            // Now the barrel is falling
-                            barrel->is_grounded = 0;
-                            // Changing the direction of the barrel (to make to zig zag movement)
-                            barrel->movement_direction *= -1;
-                        }
-                    }
-                }
+    int j = 0;
+    const ladderSegment* ladder;
+    levelInfo* info = &levels[level - 1];
+
+    // Drawing the ladders to the background, light gray color for the ladders
+    for (i = 0; i < info->ladders_count; i++){
+        ladder = &info->ladders[i];
+        for (j = ladder->y; j < ladder->y + ladder->height; j++){
+            level_background[j][ladder->x] = MAKE_CELL('|', 7);
+            level_background[j][ladder->x + 1] = MAKE_CELL('_', 7);
+            level_background[j][ladder->x + 2] = MAKE_CELL('|', 7);
+        }
+    }
+}
 
-                // if the barrel is a falling barrel
-                if (barrel->is_falling_barrel){
-                    // if it's time for the barrel to fall and the barrel in on the ground
-                    if (barrel->falling_ticks <= 0 && barrel->is_grounded){
-                        // The barrel is not on the ground (because it's falling.... dah)
-                        barrel->is_grounded = 0;
-                        // Changing the direction of the movement
-                        barrel->movement_direction *= -1;
-                        // Drop the barrel one cell down
-                        // Because right now the barrel in on top of a platform and we want it to fall
-                        add_to_object_position(barrel->obj, 0, 1);
-                        // Sets a new timer 'randomly'
-                        barrel->falling_ticks = rand() % (FALLING_BARREL_MAX_FALL + 1) + spawn_falling_barrel_speed_in_ticks;
-                    }
-                }
-                // Check for collision with the player
-                check_collision_with_a_barrel(&playerObject, i);
+// Inserts the sprite of a game object that never moves to the background
+void insert_object_to_background(gameObject* gameObj){
+    int i = 0;
+    sprite* objectSprite = gameObj->sprite;
+    spriteRun* run;
 
-                // if the barrel does not collide with the screen
-                // than it's outside the screen so we want to delete it
-                if (!check_collision_with_rectangle(barrel->obj, &screenObject)) delete_barrel(i);
-            }
-        }
+    for (i = 0; i < objectSprite->runs_count; i++){
+        run = &objectSprite->runs[i];
+        copy_cells(&level_background[gameObj->top_left_point.y + run->y][gameObj->top_left_point.x + run->x],
+            &objectSprite->cells[run->first_cell], run->length);
     }
 }
 
-// Apply gravity to all the game objects
-void apply_gravity_to_game_objects(){
+// Sets the tile of the kind in the cell
+void set_tile(int kind, int y, int x){
+    tile_rows[kind][y][x >> 4] |= 1 << (x & 15);
+    tile_columns[kind][x] |= 1UL << y;
+}
+
+// Builds the tiles of the level from the map and the ladders of the level
+void build_level_tiles(char* map, const ladderSegment* ladders, int ladders_count){
     int i = 0;
-    gameObject* barrelObj;
-
-    // if the player is not on a ladder
-    if (!on_top_ladder){
-        // if it's time to try to apply gravity to the player
-        // (we give the player some air time so we have the effect of a fall)
-        if ((elapsed_time - air_duration_elapsed) >= JUMP_DURATION_IN_TICKS){
-            // Try to move the player down
-            move_object(&playerObject, 0, 1);
+    int j = 0;
+    int kind = 0;
+    char pixel;
+
+    for (kind = 0; kind < TILE_KINDS; kind++){
+        for (i = 0; i < SCREEN_HEIGHT; i++){
+            for (j = 0; j < TILE_ROW_WORDS; j++){
+                tile_rows[kind][i][j] = 0;
+            }
+        }
+        for (j = 0; j < SCREEN_WIDTH; j++){
+            tile_columns[kind][j] = 0;
         }
     }
 
-    for (i = 0; i < MAX_BARRELS_OBJECT; i++){
-        // if the barrel exists
-        if (barrels_array[i]){
-            if (barrels_array[i]->obj){
-                // Try to move the barrel down
-                move_object(barrels_array[i]->obj, 0, 1);
-                // if the barrel it outside the screen, delete it
-                if (!check_collision_with_rectangle(barrels_array[i]->obj, &screenObject)) delete_barrel(i);
-            }
+    for (i = 0; i < SCREEN_HEIGHT; i++){
+        for (j = 0; j < SCREEN_WIDTH; j++){
+            pixel = map[i * SCREEN_WIDTH + j];
+            if (pixel == 'z' || pixel == 'Z') set_tile(TILE_SOLID, i, j);
+        }
+    }
+
+    // A ladder is 3 cells wide, the rung is in the middle
+    for (i = 0; i < ladders_count; i++){
+        for (j = ladders[i].y; j < ladders[i].y + ladders[i].height; j++){
+            set_tile(TILE_LADDER, j, ladders[i].x);
+            set_tile(TILE_LADDER, j, ladders[i].x + 1);
+            set_tile(TILE_LADDER, j, ladders[i].x + 2);
+            set_tile(TILE_LADDER_RUNG, j, ladders[i].x + 1);
         }
     }
 }
 
-// Copies the display_draft to the display so it can be draw
-void save_display_draft(){
+// Draws the static parts of the level into the background
+void build_level_background(int level){
     int i = 0;
     int j = 0;
-    
-    // Loops through the display and copy the display draft to it
+    levelInfo* info = &levels[level - 1];
+
+    // Kong and the princess are where the level puts them
+    kongObject->top_left_point.x = info->kong_x;
+    kongObject->top_left_point.y = info->kong_y;
+    princessObject->top_left_point.x = info->princess_x;
+    princessObject->top_left_point.y = info->princess_y;
+
+    // The map
+    unpack_screen(info->packed_map, unpacked_screen[0]);
     for (i = 0; i < SCREEN_HEIGHT; i++){
         for (j = 0; j < SCREEN_WIDTH; j++){
-            display[SCREEN_WIDTH * i + j] = display_draft[i][j];
-            display_color[SCREEN_WIDTH * i + j] = display_draft_color[i][j];
+            level_background[i][j] = MAKE_CELL(unpacked_screen[i][j], 12);
         }
     }
-    // Setting the null char (the last char of the array)
-    display[SCREEN_SIZE] = '\0';
+
+    insert_ladders_to_background(level);
+    build_level_tiles(unpacked_screen[0], info->ladders, info->ladders_count);
+    // From where kong spawns the barrels
+    build_barrel_trajectory(kongObject->top_left_point.x + 1, kongObject->top_left_point.y + 2);
+
+    // Princess
+    insert_object_to_background(princessObject);
+    // Kong
+    insert_object_to_background(kongObject);
+
+    background_level = level;
+    // The frames dont hold this background yet
+    background_version++;
 }
 
-// Inserts the ladders to the map
-// level - the level num
-void insert_ladders_to_map(int level){
+// Returns 1 if the packed screen unpacks to exactly one screen, without going after it's bytes
+int is_packed_screen_valid(unsigned char* packed, unsigned int bytes){
+    unsigned int i = 0;
+    int cells = 0;
+    int count;
+
+    while (i < bytes && cells < SCREEN_SIZE){
+        count = packed[i] & 0x7F;
+        if (count == 0) return 0;
+
+        // A run is the count and the char, otherwise the count and the chars
+        if (packed[i] & 0x80) i += 2;
+        else i += count + 1;
+        cells += count;
+    }
+
+    return i == bytes && cells == SCREEN_SIZE;
+}
+
+// Returns 1 if the area is all inside the screen
+int is_area_in_screen(int x, int y, int width, int height){
+    return x >= 0 && y >= 0 && width > 0 && height > 0 && x + width <= SCREEN_WIDTH && y + height <= SCREEN_HEIGHT;
+}
+
+// Returns 1 if everything in the level is inside the screen and the timings make sense
+int is_level_valid(levelInfo* info){
     int i = 0;
-    int j = 0;
+    const hammerPlatform* platform;
+
+    if (info->spawn_barrel_speed_in_ticks <= 0 || info->spawn_falling_barrel_speed_in_ticks <= 0 ||
+    info->barrel_movement_speed_in_ticks <= 0 || info->apply_gravity_every_ticks <= 0) return 0;
+
+    // The timings are turned to game ticks (TICKS) and added to game_time, a huge one would overflow
+    if (info->spawn_barrel_speed_in_ticks > LEVEL_MAX_TIMING || info->spawn_falling_barrel_speed_in_ticks > LEVEL_MAX_TIMING ||
+    info->barrel_movement_speed_in_ticks > LEVEL_MAX_TIMING || info->apply_gravity_every_ticks > LEVEL_MAX_TIMING) return 0;
+
+    if (!is_area_in_screen(info->player_start_x, info->player_start_y, playerObject->width, playerObject->height) ||
+    !is_area_in_screen(info->kong_x, info->kong_y, kongObject->width, kongObject->height) ||
+    !is_area_in_screen(info->princess_x, info->princess_y, princessObject->width, princessObject->height)) return 0;
 
-    // Change the ladders map accroding to what level we are
-    switch (level){
-        case 1: ladder_map_ptr = ladders_level_1[0];
-        break;
-        case 2: ladder_map_ptr = ladders_level_2[0];
-        break;
-        case 3: ladder_map_ptr = ladders_level_3[0];
-        break;
+    // A ladder is 3 cells wide
+    for (i = 0; i < info->ladders_count; i++){
+        if (!is_area_in_screen(info->ladders[i].x, info->ladders[i].y, 3, info->ladders[i].height)) return 0;
     }
 
-    // Copying the ladders to the draft
-    for (i = 0; i < SCREEN_HEIGHT; i++){
-        for (j = 0; j < SCREEN_WIDTH; j++){
-            // Getting the current cell in the matrix of ladders
-            char currentPixel = ladder_map_ptr[SCREEN_WIDTH * i + j];
-            // if it's a ladder we want to add it to the draft
-            if (currentPixel == '|' || currentPixel == '_'){
-                display_draft[i][j] = currentPixel;
-                // light gray color for the ladders
-                display_draft_color[i][j] = 7;
+    // The hammer needs somewhere to spawn
+    if (info->hammer_platforms_count <= 0) return 0;
+    for (i = 0; i < info->hammer_platforms_count; i++){
+        platform = &info->hammer_platforms[i];
+        if (platform->x_min >= platform->x_max) return 0;
+        if (!is_area_in_screen(platform->x_min, platform->y,
+        platform->x_max - platform->x_min - 1 + hammerObject->width, hammerObject->height)) return 0;
+    }
+
+    return 1;
+}
+
+// Reads the next level of the level pack into info
+// Returns 1 if the level was read and it's valid
+int read_level_pack_level(int handle, levelInfo* info){
+    levelPackLevel header;
+    ladderSegment* ladders = &level_pack_ladders[level_pack_ladders_used];
+    hammerPlatform* platforms = &level_pack_hammer_platforms[level_pack_hammer_platforms_used];
+    unsigned char* map = &level_pack_maps[level_pack_maps_used];
+
+    if (!dos_read_file(handle, &header, sizeof(header))) return 0;
+
+    // Everything has to fit in what is left of the level pack memory
+    if (header.ladders_count > LEVEL_PACK_MAX_LADDERS - level_pack_ladders_used ||
+    header.hammer_platforms_count > LEVEL_PACK_MAX_HAMMER_PLATFORMS - level_pack_hammer_platforms_used ||
+    header.map_bytes > LEVEL_PACK_MAPS_BYTES - level_pack_maps_used) return 0;
+
+    if (!dos_read_file(handle, ladders, header.ladders_count * sizeof(ladderSegment)) ||
+    !dos_read_file(handle, platforms, header.hammer_platforms_count * sizeof(hammerPlatform)) ||
+    !dos_read_file(handle, map, header.map_bytes)) return 0;
+
+    if (!is_packed_screen_valid(map, header.map_bytes)) return 0;
+
+    info->packed_map = map;
+    info->ladders = ladders;
+    info->ladders_count = header.ladders_count;
+    info->hammer_platforms = platforms;
+    info->hammer_platforms_count = header.hammer_platforms_count;
+    info->player_start_x = header.player_start_x;
+    info->player_start_y = header.player_start_y;
+    info->kong_x = header.kong_x;
+    info->kong_y = header.kong_y;
+    info->princess_x = header.princess_x;
+    info->princess_y = header.princess_y;
+    info->spawn_barrel_speed_in_ticks = header.spawn_barrel_speed_in_ticks;
+    info->spawn_falling_barrel_speed_in_ticks = header.spawn_falling_barrel_speed_in_ticks;
+    info->barrel_movement_speed_in_ticks = header.barrel_movement_speed_in_ticks;
+    info->apply_gravity_every_ticks = header.apply_gravity_every_ticks;
+    info->flags = header.flags;
+
+    if (!is_level_valid(info)) return 0;
+
+    level_pack_ladders_used += header.ladders_count;
+    level_pack_hammer_platforms_used += header.hammer_platforms_count;
+    level_pack_maps_used += header.map_bytes;
+
+    return 1;
+}
+
+// Loads the levels of the level pack (see README for how the file is built)
+// Returns 1 if all the levels of the level pack were loaded
+int load_level_pack(){
+    char magic[4];
+    // The version and how many levels
+    unsigned int header[2];
+    int handle;
+    int loaded = 0;
+
+    handle = dos_open_file(LEVEL_PACK_FILE_NAME);
+    if (handle < 0) return 0;
+
+    level_pack_ladders_used = 0;
+    level_pack_hammer_platforms_used = 0;
+    level_pack_maps_used = 0;
+    levels_count = 0;
+
+    if (dos_read_file(handle, magic, 4) && magic[0] == 'K' && magic[1] == 'L' && magic[2] == 'V' && magic[3] == 'L' &&
+    dos_read_file(handle, header, sizeof(header)) &&
+    header[0] == LEVEL_PACK_VERSION && header[1] > 0 && header[1] <= MAX_LEVELS){
+        while (levels_count < header[1] && read_level_pack_level(handle, &levels[levels_count])) levels_count++;
+        loaded = levels_count == header[1];
+    }
+
+    dos_close_file(handle);
+    return loaded;
+}
+
+// Loads the levels of the game, from the level pack if there is one
+// otherwise (or if the level pack is broken) the built in levels are played
+void load_levels(){
+    int i = 0;
+
+    if (load_level_pack()) return;
+
+    levels_count = sizeof(builtin_levels) / sizeof(levelInfo);
+    for (i = 0; i < levels_count; i++){
+        levels[i] = builtin_levels[i];
+    }
+}
+
+// Restores the background of the level to the draft
+// Only the areas that were drawn on top of the background are restored
+void restore_draft_background(){
+    int i = 0;
+    int j = 0;
+    rect* area;
+
+    // The level changed, we need a new background
+    if (background_level != game_level) build_level_background(game_level);
+
+    if (frame_background_version[draft_frame_index] != background_version){
+        // The draft holds something else (a menu, the last level), copying the whole background
+        copy_cells(&display_draft[0][0], &level_background[0][0], SCREEN_SIZE);
+        frame_background_version[draft_frame_index] = background_version;
+        mark_all_dirty();
+        // The widgets were erased from the draft
+        for (i = 0; i < HUD_WIDGETS_COUNT; i++){
+            hud_widgets[i]->redraw_mask |= FRAME_BIT(draft_frame_index);
+        }
+    }else {
+        for (i = 0; i < drawn_rects_count[draft_frame_index]; i++){
+            area = &drawn_rects[draft_frame_index][i];
+            for (j = area->y; j < area->y + area->height; j++){
+                copy_cells(&display_draft[j][area->x], &level_background[j][area->x], area->width);
             }
+            invalidate_widgets_in_rect(area);
         }
+
+        // The screen shows something else (a menu), everything changed
+        if (frame_background_version[display_frame_index] != background_version) mark_all_dirty();
     }
+
+    drawn_rects_count[draft_frame_index] = 0;
 }
 
-// Used to insert models of game objects to the display draft
-void insert_model_to_draft(gameObject* gameObj, char color_byte){
-    // To iterate the display draft height
+// Compiles the model of the sprite to runs of opaque cells
+void compile_sprite(sprite* spr){
     int i = 0;
-    // To iterate the display draft width
     int j = 0;
-    // To iterate the object model
-    int k = 0;
+    char pixel;
+    // The run we are adding cells to (NULL = we are between runs)
+    spriteRun* run;
+    int cells_count = 0;
+
+    spr->runs_count = 0;
+
+    for (i = 0; i < spr->height; i++){
+        // Runs dont continue to the next row
+        run = NULL;
+        for (j = 0; j < spr->width; j++){
+            pixel = spr->model[i * spr->width + j];
+
+            // Spaces are transparent, they end the run
+            if (pixel == ' '){
+                run = NULL;
+                continue;
+            }
 
-    /* Vars to ease of use */
-    // The position of the top left point of the model of the object
-    position objectPos = gameObj->top_left_point;
-
-    // Getting the model's position
-    int top_left_x = objectPos.x;
-    int top_left_y = objectPos.y;
-
-    // Getting the model dimensions
-    int model_height = gameObj->height;
-    int model_width = gameObj->width;
-
-    // Getting the object's model
-    char* objectModel = (char*) gameObj->model;
-
-    // We need to start saving to the draft from the
-    // top left point (kinda the position of the object)
-    // and keep drawing from there
-    // top_left_y <= i < top_left_y + model height
-    // top_left_x <= j < top_left_x + model width
-    for (i = top_left_y; i < top_left_y + model_height; i++){
-        for (j = top_left_x; j < top_left_x + model_width; j++){
-            // We want to add only the parts that are inside the screen borders
-            // So we check if the current position is inside or outside the screen
-            if (!(i >= SCREEN_HEIGHT)){
-                // Insert the model to the display draft
-                display_draft[i][j] = objectModel[k];
-                // Insert the model's color to the display draft
-                display_draft_color[i][j] = color_byte;
-                k++;
+            // Starting a new run
+            if (run == NULL){
+                run = &spr->runs[spr->runs_count];
+                spr->runs_count++;
+                run->x = j;
+                run->y = i;
+                run->length = 0;
+                run->first_cell = cells_count;
             }
+
+            spr->cells[cells_count] = MAKE_CELL(pixel, spr->color_byte);
+            cells_count++;
+            run->length++;
+        }
+    }
+}
+
+// Compiles all the sprites of the game
+void compile_sprites(){
+    compile_sprite(&mario_sprite);
+    compile_sprite(&princess_sprite);
+    compile_sprite(&kong_sprite);
+    compile_sprite(&hammer_sprite);
+    compile_sprite(&barrel_sprite);
+    compile_sprite(&falling_barrel_sprite);
+}
+
+// Draws the sprite to the display draft with it's top left point at (x, y)
+// Only the parts that are inside the screen are drawn
+void insert_sprite_to_draft(sprite* spr, int x, int y){
+    int i = 0;
+    int row;
+    // The first and the end (exclusive) column of the run in the screen
+    int start;
+    int end;
+    unsigned int* cells;
+    spriteRun* run;
+
+    for (i = 0; i < spr->runs_count; i++){
+        run = &spr->runs[i];
+
+        row = y + run->y;
+        // The row is outside the screen
+        if (row < 0 || row >= SCREEN_HEIGHT) continue;
+
+        start = x + run->x;
+        end = start + run->length;
+        cells = &spr->cells[run->first_cell];
+
+        // Clipping the run to the left and right edges of the screen
+        if (start < 0){
+            cells -= start;
+            start = 0;
+        }
+        if (end > SCREEN_WIDTH) end = SCREEN_WIDTH;
+        if (start >= end) continue;
+
+        copy_cells(&display_draft[row][start], cells, end - start);
+        mark_dirty_cells(row, start, end - 1);
+    }
+}
+
+// Used to insert game objects to the display draft
+void insert_object_to_draft(gameObject* gameObj){
+    // Saving the area so the background will be restored there next time
+    record_drawn_rect(gameObj->top_left_point.x, gameObj->top_left_point.y, gameObj->width, gameObj->height);
+
+    insert_sprite_to_draft(gameObj->sprite, gameObj->top_left_point.x, gameObj->top_left_point.y);
+}
+
+// Inserts the barrel to the display draft
+void insert_barrel_to_draft(int i){
+    // Saving the area so the background will be restored there next time
+    record_drawn_rect(barrel_x[i], barrel_y[i], BARREL_WIDTH, BARREL_HEIGHT);
+
+    if (barrel_is_falling[i]) insert_sprite_to_draft(&falling_barrel_sprite, barrel_x[i], barrel_y[i]);
+    else insert_sprite_to_draft(&barrel_sprite, barrel_x[i], barrel_y[i]);
+}
+
+// Does everything the barrels do in a step of the game:
+// every barrel gets it's timers, gravity and movement (and leaves the game if it left the screen),
+// than the hammer and the player are tested against the barrels in their rows (see collide_object_with_barrels)
+// and every barrel is hit by the hammer, hits the player or is drawn
+// apply_gravity - is it time to apply gravity
+// draw - should the barrels be drawn (only the last step of a frame is drawn)
+void step_barrels(int apply_gravity, int draw){
+    int i = 0;
+    // How many barrels the hammer / the player collided with
+    int hammer_hits_count = 0;
+    int player_hits_count = 0;
+
+    // From the last barrel, so deleting a barrel does not move a barrel we did not step yet
+    for (i = barrels_count - 1; i >= 0; i--){
+        if (apply_gravity) apply_gravity_to_barrel(i);
+        move_barrel(i);
+        reindex_barrel(i);
+
+        // if the barrel does not collide with the screen
+        // than it's outside the screen so we want to delete it
+        if (!is_barrel_in_screen(i)) delete_barrel(i);
+    }
+
+    if (is_hammer_striking) hammer_hits_count = collide_object_with_barrels(hammerObject, barrel_hammer_hits);
+    player_hits_count = collide_object_with_barrels(playerObject, barrel_player_hits);
+
+    // From the last barrel again, a deleted barrel is replaced only by a barrel we already handled
+    for (i = barrels_count - 1; i >= 0; i--){
+        // (if the hammer ran out of hits, the new hammer is not striking)
+        if (hammer_hits_count && is_hammer_striking && barrel_hammer_hits[i]){
+            handle_hammer_hit_barrel(i);
+            continue;
         }
+
+        if (player_hits_count && barrel_player_hits[i]){
+            handle_barrel_collision(playerObject, i);
+            continue;
+        }
+
+        if (draw) insert_barrel_to_draft(i);
     }
+
+    // The hit was checked against all the barrels
+    is_hammer_striking = 0;
 }
 
-// Refills the dispaly draft with map
-void refill_display_draft(char map[SCREEN_HEIGHT][SCREEN_WIDTH], char color_byte){
+// Refills the dispaly draft with a packed screen (from maps.h)
+void refill_display_draft(const unsigned char* packed_map, char color_byte){
     int i = 0;
     int j = 0;
 
+    unpack_screen(packed_map, unpacked_screen[0]);
+
+    // The draft does not hold the level background anymore
+    frame_background_version[draft_frame_index] = -1;
+    drawn_rects_count[draft_frame_index] = 0;
+
     // Loops through the display draft and fills in with the map
     // and also fills the display draft color with the wanted color
     for (i = 0; i < SCREEN_HEIGHT; i++){
         for (j = 0; j < SCREEN_WIDTH; j++){
-            display_draft[i][j] = map[i][j];
-            display_draft_color[i][j] = color_byte;
+            set_draft_cell(i, j, unpacked_screen[i][j], color_byte);
         }
     }
 }
 
-// Creates a barrel with at (x,y) with movement ticks and gravity ticks
-void create_barrel(int x, int y, int movement, int gravity, int is_falling, int falling_ticks){
-    barrel* barrel;
-    gameObject* barrelObj;
+// Creates a barrel with at (x,y), it moves in movement ticks (and a falling barrel falls in falling_ticks)
+void create_barrel(int x, int y, int movement, int is_falling, int falling_ticks){
+    // The new barrel goes after the last one
+    int index_in_array = barrels_count;
 
-    // if there is no place in the array for the barrel
+    // if all the barrels are used
     // we dont want to create it because we are full
-    if (barrels_array[barrels_array_index]) return;
-
-    // Allocate memory
-    barrel = (struct Barrel*) getmem(sizeof(struct Barrel));
-    barrelObj = (struct GameObject*) getmem(sizeof(struct GameObject));
-
-    // Failed to allocate memory
-    if (!barrel || !barrelObj) return;
-
-    // Init the game object of the barrel
-    strcpy(barrelObj->label, "Barrel");
-    if (!is_falling)
-        barrelObj->model = (char**) barrel_model;
-    else barrelObj->model = (char**) falling_barrel_model;
-    barrelObj->top_left_point.x = x;
-    barrelObj->top_left_point.y = y;
-    barrelObj->width = 2;
-    barrelObj->height = 1;
-
-    // Init the barrel object
-    barrel->obj = barrelObj;
-    barrel->movement_ticks = movement;
-    barrel->gravity_ticks = gravity;
-    barrel->is_grounded = 1;
-    barrel->movement_direction = 1;
-    barrel->is_falling_barrel = is_falling;
-    barrel->falling_ticks = falling_ticks;
-
-    // Adding the barrel to the barrels array
-    barrels_array[barrels_array_index] = barrel;
-    barrels_array_index++;
-    if (barrels_array_index >= MAX_BARRELS_OBJECT) barrels_array_index = 0;
+    if (index_in_array >= MAX_BARRELS_OBJECT) return;
+
+    // Init the barrel
+    barrel_x[index_in_array] = x;
+    barrel_y[index_in_array] = y;
+    barrel_move_time[index_in_array] = game_time + movement;
+    barrel_is_grounded[index_in_array] = 1;
+    barrel_movement_direction[index_in_array] = 1;
+    barrel_is_falling[index_in_array] = is_falling;
+    barrel_fall_time[index_in_array] = game_time + falling_ticks;
+    // A barrel that is spawned where the trajectory starts, moves on it
+    barrel_trajectory_step[index_in_array] = find_barrel_trajectory_step(x, y, 1);
+    index_barrel(index_in_array);
+
+    // Only now the barrel is in the game
+    barrels_count++;
 }
 
 // Handles the scan code of the input from the keybaord
 void handle_player_movement(int input_scan_code){
     // Using the input change the position of the player
-    //position* playerPos = &(playerObject.top_left_point);
+    //position* playerPos = &(playerObject->top_left_point);
 
     // Checks for collision below the player with the map
-    int collision_result_map = check_collision_with_map(&playerObject, 0, 1);
+    int collision_result_map = check_collision_with_map(playerObject, 0, 1);
     // Checks for collision inside the player for ladders
-    int check_movement_ladder_inside = check_collision_with_ladder(&playerObject, 0);
+    int check_movement_ladder_inside = check_collision_with_ladder(playerObject, 0);
     // Checks for collision below the player for ladders
-    int check_movement_ladder_below = check_collision_with_ladder(&playerObject, 1);
+    int check_movement_ladder_below = check_collision_with_ladder(playerObject, 1);
 
     // 1: if the player collided with the map and he is not inside a ladder
     // we are not on a ladder
@@ -1315,7 +3193,7 @@ void handle_player_movement(int input_scan_code){
                 //if (is_with_hammer)
                 //    reset_hammer();
                 // Try to move the player up
-                move_object(&playerObject, 0, -1);
+                move_object(playerObject, 0, -1);
             }else {
                 // if the player is not near a ladder
                 // than he is trying to jump
@@ -1326,11 +3204,11 @@ void handle_player_movement(int input_scan_code){
         }else if ((input_scan_code == ARROW_RIGHT) || (input_scan_code == KEY_D)){
             // Movement direction is to the right
             player_movement_direction = 1;
-            move_object(&playerObject, 1, 0);
+            move_object(playerObject, 1, 0);
         }else if ((input_scan_code == ARROW_LEFT) || (input_scan_code == KEY_A)){
             // Movement direction it to the left
             player_movement_direction = -1;
-            move_object(&playerObject, -1, 0);
+            move_object(playerObject, -1, 0);
         }else if ((input_scan_code == ARROW_DOWN) || (input_scan_code == KEY_S)){
             // if the player is above a ladder or on top of a ladder
 
@@ -1339,7 +3217,7 @@ void handle_player_movement(int input_scan_code){
             if ((check_movement_ladder_inside && on_top_ladder) || check_movement_ladder_below){
                 // The player is on top of a ladder
                 on_top_ladder = 1;
-                move_object(&playerObject, 0, 1);
+                move_object(playerObject, 0, 1);
             }
         }else if (input_scan_code == KEY_SPACE){
             // if the player is with the hammer
@@ -1360,8 +3238,10 @@ int handle_menu_movement(int input_scan_code, int count_of_menues){
 
     if (input_scan_code == ARROW_UP){
         menu_index--;
+        menu_redraw = 1;
     }else if (input_scan_code == ARROW_DOWN){
         menu_index++;
+        menu_redraw = 1;
     }else if (input_scan_code == KEY_ENTER){
         return 1;
     }
@@ -1373,60 +3253,40 @@ int handle_menu_movement(int input_scan_code, int count_of_menues){
     return 0;
 }
 
-// Inserts the indication of the life of the player to the display draft
-void inesrt_player_life_to_draft(){
-    char heart;
+// Inserts the widget to the display draft, only if the draft does not hold it's text
+void insert_widget_to_draft(widget* w){
     int i = 0;
-    int clock_offset = 7;
+    int x;
+    unsigned int* background = &level_background[w->y][0];
 
-    for (i = 0; i < player_lives; i++){
-        // For every life the player has we print
-        display_draft[0][SCREEN_WIDTH - clock_offset - i] = '$';
-        // red color
-        display_draft_color[0][SCREEN_WIDTH - clock_offset - i] = 4;
-    }
-}
+    if (!(w->redraw_mask & FRAME_BIT(draft_frame_index))) return;
 
-// Inserts the score text of the player to the display draft
-void insert_player_score_to_draft(int y, int offset, char color_byte){
-    int i = 0;
-    int iteration_score = player_score;
+    // Clearing the bit before drawing
+    // if the text is changed while we draw it, the widget will be drawn again next time
+    w->redraw_mask &= ~FRAME_BIT(draft_frame_index);
 
-    for (i = 0; i < 5; i++){
-        // int to ascii
-        display_draft[y][SCREEN_WIDTH - offset - i] = (iteration_score % 10) + '0';
-        display_draft_color[y][SCREEN_WIDTH - offset - i] = color_byte;
-        iteration_score /= 10;
+    for (i = 0; i < w->length; i++){
+        x = w->x + i;
+        if (w->text[i] == ' ') set_draft_cell(w->y, x, background[x], background[x] >> 8);
+        else set_draft_cell(w->y, x, w->text[i], w->color_byte);
     }
 }
 
-// Inserts the clock the the display draft
-void insert_clock_to_draft(){
-    // Just inserts the clock of the game to the dispaly draft
-    char c_min_h;
-    char c_min_l;
-    char c_sec_h;
-    char c_sec_l;
-
-    c_min_h = (clock_minutes / 10 % 10) + '0';
-    c_min_l = (clock_minutes % 10) + '0';
-    c_sec_h = (clock_seconds / 10 % 10) + '0';
-    c_sec_l = (clock_seconds % 10) + '0';
+// Inserts the 'HUD' widgets to the display draft
+void insert_hud_to_draft(){
+    int i = 0;
 
-    display_draft[0][SCREEN_WIDTH - 5] = c_min_h;
-    display_draft[0][SCREEN_WIDTH - 4] = c_min_l;
-    display_draft[0][SCREEN_WIDTH - 3] = ':';
-    display_draft[0][SCREEN_WIDTH - 2] = c_sec_h;
-    display_draft[0][SCREEN_WIDTH - 1] = c_sec_l;
+    for (i = 0; i < HUD_WIDGETS_COUNT; i++){
+        insert_widget_to_draft(hud_widgets[i]);
+    }
 }
 
 // Deletes all the barrels
 void delete_all_barrels(){
     int i = 0;
     
-    for (i = 0; i < MAX_BARRELS_OBJECT; i++){
-        if (barrels_array[i])
-            delete_barrel(i);
+    for (i = barrels_count - 1; i >= 0; i--){
+        delete_barrel(i);
     }
 }
 
@@ -1435,21 +3295,28 @@ void init_vars_level(){
     // Lock the game
     game_init = 0;
 
+    // The level that is going to be played
+    current_level = &levels[game_level - 1];
+
     delete_all_barrels();
 
     player_lives = PLAYER_LIFE_COUNT;
+    update_player_lives_text();
 
     /* Reposition the player */
-    playerObject.top_left_point.x = PLAYER_START_POS_X;
-    playerObject.top_left_point.y = PLAYER_START_POS_Y;
+    playerObject->top_left_point.x = current_level->player_start_x;
+    playerObject->top_left_point.y = current_level->player_start_y;
 
     /* Restart the clock */
     clock_ticks = 0;
     clock_seconds = 0;
     clock_minutes = 0;
+    strcpy(clock_text, "00:00");
+    invalidate_widget(&clock_widget);
     elapsed_time = 0;
+    game_time = 0;
+    dropped_ticks = 0;
     deltaTime_counter = 0;
-    time_handler_last_call = 0;
     deltaSeconds = 0;
 
     /* Restart the input queue */
@@ -1467,16 +3334,22 @@ void init_vars_level(){
     is_hammer_exist = 0;
 
     /* Restart barrels vars */
-    barrels_array_index = 0;
-    spawn_barrel_timer = 0;
-    spawn_barrel_speed_in_ticks = 6 * 18;
-    barrel_movement_speed_in_ticks = 5;
-    spawn_falling_barrel_timer = 4 * 18;
-    spawn_falling_barrel_speed_in_ticks = 4 * 18;
+    // The times of the level are in BIOS ticks
+    spawn_barrel_speed_in_ticks = TICKS(current_level->spawn_barrel_speed_in_ticks);
+    barrel_movement_speed_in_ticks = TICKS(current_level->barrel_movement_speed_in_ticks);
+    spawn_falling_barrel_speed_in_ticks = TICKS(current_level->spawn_falling_barrel_speed_in_ticks);
 
     /* Restart gravity vars */
-    apply_gravity_every_ticks = 5;
-    gravity_ticks = 5;
+    apply_gravity_every_ticks = TICKS(current_level->apply_gravity_every_ticks);
+
+    /* Restart the timers */
+    reset_timer_wheel();
+    // The first barrel is spawned right away
+    schedule_timer(TIMER_SPAWN_BARREL, 0);
+    // if kong throws falling barrels in this level
+    if (current_level->flags & LEVEL_FALLING_BARRELS)
+        schedule_timer(TIMER_SPAWN_FALLING_BARREL, spawn_falling_barrel_speed_in_ticks);
+    schedule_timer(TIMER_GRAVITY, apply_gravity_every_ticks);
 
     // Spawn a new hammer
     reset_hammer();
@@ -1490,7 +3363,7 @@ void init_vars(){
     // Lock the game
     game_init = 0;
 
-    player_score = 0;
+    reset_score_points();
 
     init_vars_level();
 
@@ -1507,9 +3380,10 @@ int center_text_in_screen(int len){
 void insert_text_to_draft(char* text, int len, int start_x, int start_y, char color_byte, int left_offset){
     int i = 0;
 
+    record_drawn_rect(start_x + left_offset, start_y, len, 1);
+
     for (i = 0; i < len; i++){
-        display_draft[start_y][start_x + i + left_offset] = text[i];
-        display_draft_color[start_y][start_x + i + left_offset] = color_byte;
+        set_draft_cell(start_y, start_x + i + left_offset, text[i], color_byte);
     }
 }
 
@@ -1518,6 +3392,11 @@ void insert_text_to_center_of_draft(char* text, int len, int start_y, char color
     insert_text_to_draft(text, len, center_text_in_screen(len), start_y, color_byte, left_offset);
 }
 
+// Inserts the score text of the player to the display draft (used by the menus)
+void insert_player_score_to_draft(int y, int offset, char color_byte){
+    insert_text_to_draft(player_score_digits, SCORE_DIGITS, SCREEN_WIDTH - offset - SCORE_DIGITS + 1, y, color_byte, 0);
+}
+
 // Handles the pressing of menu button
 void handle_menu_entered(int entered, GameState changeToState){
     // if the user pressed enter
@@ -1530,11 +3409,7 @@ void handle_menu_entered(int entered, GameState changeToState){
 
             case 1:
                 // The player want to exit the game
-                // Resets the output to the screen
-                reset_output_to_screen();
-                wipe_entire_screen();
-                set_speaker(0);
-                asm INT 27;
+                exit_game();
             break;
         }
     }
@@ -1557,101 +3432,75 @@ int updater_handle_menu_input(int count_of_menues){
     return result;
 }
 
-// Inserts the models of all the barrels to the dispaly draft
-void updater_insert_barrels_to_display_draft(){
-    int i = 0;
-
-    for (i = 0; i < MAX_BARRELS_OBJECT; i++){
-        // Only if the barrel exists
-        if (barrels_array[i]){
-            if (barrels_array[i]->obj){
-                // if the barrel is a normal one we want to insert to normal barrel model
-                // if it's a falling barrel we want to insert a falling barrel model
-                if (!barrels_array[i]->is_falling_barrel){
-                    insert_model_to_draft(barrels_array[i]->obj, 3);
-                } else insert_model_to_draft(barrels_array[i]->obj, 9);
-            }
-        }
-    }
-}
-
 // Inserts models to the display draft
 void updater_insert_models_to_display_draft(){
-    // Barrels
-    updater_insert_barrels_to_display_draft();
-    // Princess
-    insert_model_to_draft(&princessObject, 13);
-    // Player
-    insert_model_to_draft(&playerObject, 14);
-    // Kong
-    insert_model_to_draft(&kongObject, 6);
+    int i = 0;
+    gameObject* obj;
 
-    // Only if the hammer exist in the map we want to draw it
-    if (is_hammer_exist)
-        insert_model_to_draft(&hammerObject, 15);
-}
+    // In the order of the table, so the hammer is drawn on top of the player
+    for (i = 0; i < MAX_ENTITIES; i++){
+        obj = &entities[i];
 
-// Checks for collisions of the player with the barrels
-void updater_player_barrels_collision(){
-    int j = 0;
+        // Not in the game, or never moves (the princess and kong are in the background)
+        if (!(obj->flags & OBJECT_ACTIVE) || (obj->flags & OBJECT_IN_BACKGROUND)) continue;
 
-    for (j = 0; j < MAX_BARRELS_OBJECT; j++){
-        // if the barrel exists
-        if (barrels_array[j]){
-            // if the barrel's game object exists
-            if (barrels_array[j]->obj){
-                // Check if the player is colliding with the barrels
-                check_collision_with_a_barrel(&playerObject, j);
-            }
-        }
+        // Only if the hammer exist in the map we want to draw it
+        if (obj->kind == KindHammer && !is_hammer_exist) continue;
+
+        insert_object_to_draft(obj);
     }
 }
 
 // Checks if it's time to spawn a new falling barrel
 void updater_spawn_falling_barrel_timer(){
-    // if the spawning falling barrel timer is done we need to spawn a new one
-    if (spawn_falling_barrel_timer <= 0 && game_level > 1){
-        create_barrel(kongObject.top_left_point.x + 1, kongObject.top_left_point.y + 2,
-        barrel_movement_speed_in_ticks, 0, 1, FALLING_BARREL_SPAWN_IN_TICKS);
-        // Resetting the spawning falling barrel timer
-        spawn_falling_barrel_timer = spawn_falling_barrel_speed_in_ticks;
+    // if the spawning falling barrel timer fired we need to spawn a new one
+    // (it's set only in levels with falling barrels)
+    if (take_timer_fired(TIMER_SPAWN_FALLING_BARREL)){
+        create_barrel(kongObject->top_left_point.x + 1, kongObject->top_left_point.y + 2,
+        barrel_movement_speed_in_ticks, 1, FALLING_BARREL_SPAWN_IN_TICKS);
+        // Setting the spawning falling barrel timer again
+        schedule_timer(TIMER_SPAWN_FALLING_BARREL, spawn_falling_barrel_speed_in_ticks);
     }
 }
 
 // Checks if it's time to spawn a new normal barrel
 void updater_spawn_normal_barrel_timer(){
-    // if the spawning barrel timer is done we need to spawn a new one
-    if (spawn_barrel_timer <= 0){
+    // if the spawning barrel timer fired we need to spawn a new one
+    if (take_timer_fired(TIMER_SPAWN_BARREL)){
         // We create a new barrel at kong's position
-        // and init it with the speed of the movement and speed of gravity
-        create_barrel(kongObject.top_left_point.x + 1, kongObject.top_left_point.y + 2,
-        barrel_movement_speed_in_ticks, 0, 0, 0);
-        // Resetting the spawning barrel timer
-        spawn_barrel_timer = spawn_barrel_speed_in_ticks;
+        // and init it with the speed of the movement
+        create_barrel(kongObject->top_left_point.x + 1, kongObject->top_left_point.y + 2,
+        barrel_movement_speed_in_ticks, 0, 0);
+        // Setting the spawning barrel timer again
+        schedule_timer(TIMER_SPAWN_BARREL, spawn_barrel_speed_in_ticks);
     }
 }
 
 // Checks is the gravity timer is done and we need to apply gravity
-void updater_gravity_timer(){
-    // if the gravity timer is dont we need to apply gravity
-    if (gravity_ticks <= 0){
+// Returns 1 if gravity was applied (so the barrels step applies it to the barrels too)
+int updater_gravity_timer(){
+    // if the gravity timer fired we need to apply gravity
+    if (take_timer_fired(TIMER_GRAVITY)){
         // Try to apply gravity to the game objects
         apply_gravity_to_game_objects();
-        // Reset the gravity timer
-        gravity_ticks = apply_gravity_every_ticks;
+        // Setting the gravity timer again
+        schedule_timer(TIMER_GRAVITY, apply_gravity_every_ticks);
+        return 1;
     }
+
+    return 0;
 }
 
 // Checks and handels if the player is not inside of the screen
 void updater_check_is_player_in_screen_boundries(){
     // Checks if the player is not inside the screen
-    if (!check_collision_with_rectangle(&playerObject, &screenObject)){
+    if (!check_collision_with_rectangle(playerObject, &screenObject)){
         // decrease the player lifes
         sub_player_life();
 
-        // Reset the player position to the default one
-        playerObject.top_left_point.x = PLAYER_START_POS_X;
-        playerObject.top_left_point.y = PLAYER_START_POS_Y;
+        // Reset the player position to where the level starts
+        playerObject->top_left_point.x = current_level->player_start_x;
+        playerObject->top_left_point.y = current_level->player_start_y;
     }
 }
 
@@ -1664,11 +3513,11 @@ void updater_handle_player_input(){
         // Handle the input from the player
         handle_player_movement(input_queue[i]);
         // Check for collision with the princess
-        if (check_collision_with_rectangle(&playerObject, &princessObject)){
+        if (check_collision_with_rectangle(playerObject, princessObject)){
             mario_got_to_princess = 1;
         }
         // Check for collision with the hammer
-        if (check_collision_with_rectangle(&playerObject, &hammerObject) && !is_with_hammer && !on_top_ladder){
+        if (check_collision_with_rectangle(playerObject, hammerObject) && !is_with_hammer && !on_top_ladder){
             send_sound(SOUND_HAMMER_PICKUP_FREQ);
             is_with_hammer = 1;
         }
@@ -1678,137 +3527,249 @@ void updater_handle_player_input(){
     input_queue_tail = 0;
 }
 
+// Inserts the buttons of the menu (the first one and exit)
+// with the effect of hovering above the selected one
+void insert_menu_buttons_to_draft(char* first_button, int len){
+    if (menu_index == 0){
+        insert_text_to_center_of_draft(first_button, len, 13, 1, 0);
+        insert_text_to_center_of_draft("Exit", 4, 15, 7, 0);
+    }else {
+        insert_text_to_center_of_draft(first_button, len, 13, 7, 0);
+        insert_text_to_center_of_draft("Exit", 4, 15, 1, 0);
+    }
+}
+
+// Publishes the menu that was drawn into the draft
+// (the drawer may be printing, than we try again next time)
+void updater_publish_menu(){
+    if (menu_publish_pending && publish_display_draft()) menu_publish_pending = 0;
+}
+
+// Returns how many steps the simulation needs to run to get to the time (elapsed_time)
+// Up to MAX_CATCH_UP_STEPS, the ticks after that are dropped
+int updater_count_simulation_steps(){
+    // game_time never gets ahead of elapsed_time, so it's all the way around the clock at most
+    unsigned int ticks_behind = elapsed_time - game_time;
+
+    if (ticks_behind > MAX_CATCH_UP_STEPS){
+        dropped_ticks += ticks_behind - MAX_CATCH_UP_STEPS;
+        game_time = elapsed_time - MAX_CATCH_UP_STEPS;
+        return MAX_CATCH_UP_STEPS;
+    }
+
+    return ticks_behind;
+}
+
+// Returns the time, moved up to be at most ticks before game_time
+// A time that is only looked back at would wrap around after a while and look like it's in the future
+unsigned int keep_time_recent(unsigned int time, int ticks){
+    if (TICKS_BETWEEN(time, game_time) > ticks) return game_time - ticks;
+    return time;
+}
+
+// Runs one step of the simulation, moves the game one tick
+// draw - is it the last step of the frame (the barrels are drawn only then)
+void updater_simulation_step(int draw){
+    // Was gravity applied this step
+    int gravity_applied = 0;
+
+    game_time++;
+    // The last hit of the hammer and the last jump can be long ago
+    hammer_hit_duration = keep_time_recent(hammer_hit_duration, HAMMER_DURATION_IN_TICKS);
+    air_duration_elapsed = keep_time_recent(air_duration_elapsed, JUMP_DURATION_IN_TICKS);
+
+    // Handle input from the player
+    // on the last step, the keys came after the steps before it (the updater may have slept through them)
+    if (draw) updater_handle_player_input();
+
+    // Check and handle that the player is inside the screen
+    updater_check_is_player_in_screen_boundries();
+
+    // Fire the timers that are due by now
+    advance_timer_wheel();
+
+    // Is is time to apply gravity ?
+    gravity_applied = updater_gravity_timer();
+
+    // Is it time to spawn a new (normal) barrel
+    updater_spawn_normal_barrel_timer();
+    // Is it time to spawn a new (falling) barrel
+    updater_spawn_falling_barrel_timer();
+
+    // Move the barrels, check their hits and draw them (under the player and the hammer)
+    step_barrels(gravity_applied, draw);
+}
+
+// Returns in how many ticks the simulation has something to do
+// the steps until then only move the time, so the updater can sleep through them and catch up
+// (up to MAX_CATCH_UP_STEPS, so no tick is dropped)
+int updater_ticks_until_next_event(){
+    int i;
+    int ticks = MAX_CATCH_UP_STEPS;
+    int left;
+
+    // The player pressed something
+    if (input_queue_received > 0) return 1;
+
+    // The timers of the game (gravity and spawning)
+    for (i = 0; i < TIMERS_COUNT; i++){
+        if (timer_fired[i]) return 1;
+        left = timer_ticks_left(i);
+        if (timer_is_scheduled[i] && left < ticks) ticks = left;
+    }
+
+    // The barrels move and fall on their own times (they are not in the wheel, see move_barrel)
+    // this goes over all of them once a frame, the steps go over all of them anyway
+    for (i = 0; i < barrels_count; i++){
+        left = TICKS_BETWEEN(game_time, barrel_move_time[i]);
+        if (left < ticks) ticks = left;
+        if (barrel_is_falling[i] && barrel_is_grounded[i]){
+            left = TICKS_BETWEEN(game_time, barrel_fall_time[i]);
+            if (left < ticks) ticks = left;
+        }
+    }
+
+    // The clock of the HUD gets to the next second
+    left = TICKS_IN_A_SECOND - deltaTime_counter;
+    if (left < ticks) ticks = left;
+
+    // The ticks that already passed since the last step
+    ticks -= TICKS_BETWEEN(game_time, elapsed_time);
+    if (ticks < 1) return 1;
+    return ticks;
+}
+
+// Runs a frame of the game: the steps of the simulation up to the time, and than draws the draft and publishes it
+void updater_game_frame(){
+    int i;
+    // How many steps of the simulation the frame runs
+    int steps = 0;
+
+    // The simulation moves one tick every step, so it goes the same no matter when the updater runs
+    // if no tick passed since the last frame, nothing changed
+    steps = updater_count_simulation_steps();
+    if (steps == 0) return;
+
+    // Restore the background of the level where we drew last time
+    // (also loads the ladders of the level)
+    restore_draft_background();
+
+    for (i = 0; i < steps; i++){
+        updater_simulation_step(i == steps - 1);
+    }
+
+    // for debug
+    if (timer_ticks_left(TIMER_SPAWN_BARREL) > 0)
+        set_widget_number(&debug_spawn_timer_widget, timer_ticks_left(TIMER_SPAWN_BARREL) % 1000);
+    else set_widget_number(&debug_spawn_timer_widget, -1);
+
+    // for debug
+    // How many barrels are in the game
+    set_widget_number(&debug_barrels_used_widget, barrels_count % 100);
+
+    // for debug
+    // How many ticks were lost: clkint could not send them or the game dropped them to catch up
+    // (the ticks that came while a process was busy are not lost, they are counted with the next ones)
+    set_widget_number(&debug_lost_ticks_widget, (int)((clock_ticks_dropped + dropped_ticks) % 1000));
+
+    // for debug
+    // How many cells the last printed frame wrote to the screen (out of SCREEN_SIZE)
+    set_widget_number(&debug_cells_written_widget, cells_written_last_frame);
+
+    // for debug
+    // How many printed frames missed the retrace they were printed for
+    set_widget_number(&debug_retrace_misses_widget, retrace_misses % 1000);
+
+    /* Inserts the needed models to the display draft */
+    updater_insert_models_to_display_draft();
+
+    /* Inserts the 'HUD' (Heads up display) text */
+    // only the widgets that changed are drawn
+    insert_hud_to_draft();
+
+    // The frame is done, the drawer can print it
+    publish_display_draft();
+}
+
 // Handles the updating of stuff and shit
 void updater(){
 
     int i;
     int j;
-    // The recieved msg
-    int received_msg;
     // Holds if the user pressed enter or not
     int menu_result = 0;
 
     while (TRUE){
-        received_msg = receive();
+        // The steps go by elapsed_time, the ticks are taken so they dont pile up
+        receive_ticks();
 
         // if we are in game and the game is ready to be played
         if (gameState == InGame && game_init){
-            // Handle input from the player
-            updater_handle_player_input();
-                
-            // Refill the display draft with the game map
-            refill_display_draft(map_1, 12);
-            // Insert the ladders into the draft
-            insert_ladders_to_map(game_level);
-
-            // Check and handle that the player is inside the screen
-            updater_check_is_player_in_screen_boundries();
-            
-            // Is is time to apply gravity ?
-            updater_gravity_timer();
-
-            // for debug
-            if (spawn_barrel_timer > 0){
-                display_draft[0][4] = (spawn_barrel_timer / 100 % 10) + '0';
-                display_draft[0][5] = (spawn_barrel_timer / 10 % 10) + '0';
-                display_draft[0][6] = (spawn_barrel_timer % 10) + '0';
-            }
-
-            // Is it time to spawn a new (normal) barrel
-            updater_spawn_normal_barrel_timer();
-            // Is it time to spawn a new (falling) barrel
-            updater_spawn_falling_barrel_timer();
-
-            // Move the barrels
-            move_barrels();
-
-            // Check for collisions with barrels
-            updater_player_barrels_collision();
-
-            // for debug
-            display_draft[0][0] = (barrels_array_index / 10 % 10) + '0';
-            display_draft[0][1] = (barrels_array_index % 10) + '0';
-
-            /* Inserts the needed models to the display draft */
-            updater_insert_models_to_display_draft();
-
-            /* Inserts the 'HUD' (Heads up display) text */
-            insert_clock_to_draft();
-            inesrt_player_life_to_draft();
-            insert_player_score_to_draft(0, 11, 15);
-
-            // Saves the changes of the display draft to the display
-            save_display_draft();
+            updater_game_frame();
         }else if (gameState == InMenu){
             // If we are in the menu
 
-            refill_display_draft(menu, 6);
-
             // Handle the input from the user
             menu_result = updater_handle_menu_input(2);
 
             // if the user pressed enter (ENTER -> menu_result = 1)
             handle_menu_entered(menu_result, InGame);
 
-            // Inserts the menus with the effect of hovering above the selected one
-            if (menu_index == 0){
-                insert_text_to_center_of_draft("Start Game", 10, 13, 1, 0);
-                insert_text_to_center_of_draft("Exit", 4, 15, 7, 0);
-            }else {
-                insert_text_to_center_of_draft("Start Game", 10, 13, 7, 0);
-                insert_text_to_center_of_draft("Exit", 4, 15, 1, 0);
+            // The menu is drawn only when it changed
+            // (if the state changed, the next state draws it's own menu)
+            if (menu_redraw && gameState == InMenu){
+                menu_redraw = 0;
+                refill_display_draft(menu, 6);
+                insert_menu_buttons_to_draft("Start Game", 10);
+                menu_publish_pending = 1;
             }
 
-            save_display_draft();
+            updater_publish_menu();
         }else if (gameState == InGameOver){
             // if we are in the game over menu
-            refill_display_draft(menu_game_over, 4);
-            
+
             // Handle the input from the user
             menu_result = updater_handle_menu_input(2);
 
             // if the user pressed enter (ENTER -> menu_result = 1)
             handle_menu_entered(menu_result, InMenu);
 
-            // Inserts the points the player scored
-            insert_text_to_center_of_draft("Points:", 7, 11, 15, -6);
-            insert_player_score_to_draft(11, center_text_in_screen(5) - 5, 15);
-
-            // Inserts the menus with the effect of hovering above the selected one
-            if (menu_index == 0){
-                insert_text_to_center_of_draft("Main Menu", 9, 13, 1, 0);
-                insert_text_to_center_of_draft("Exit", 4, 15, 7, 0);
-            }else {
-                insert_text_to_center_of_draft("Main Menu", 9, 13, 7, 0);
-                insert_text_to_center_of_draft("Exit", 4, 15, 1, 0);
+            if (menu_redraw && gameState == InGameOver){
+                menu_redraw = 0;
+                refill_display_draft(menu_game_over, 4);
+                // Inserts the points the player scored
+                insert_text_to_center_of_draft("Points:", 7, 11, 15, -6);
+                insert_player_score_to_draft(11, center_text_in_screen(5) - 5, 15);
+                insert_menu_buttons_to_draft("Main Menu", 9);
+                menu_publish_pending = 1;
             }
 
-            save_display_draft();
+            updater_publish_menu();
         }else if (gameState == InGameWon){
             // if we are in the game won menu
-            refill_display_draft(menu_game_won, 14);
-            
+
             // Handle the input from the user
             menu_result = updater_handle_menu_input(2);
 
             // if the user pressed enter (ENTER -> menu_result = 1)
             handle_menu_entered(menu_result, InMenu);
 
-            // Inserts the points the player scored
-            insert_text_to_center_of_draft("Points:", 7, 11, 15, -6);
-            insert_player_score_to_draft(11, center_text_in_screen(5) - 5, 15);
-
-            // Inserts the menus with the effect of hovering above the selected one
-            if (menu_index == 0){
-                insert_text_to_center_of_draft("Main Menu", 9, 13, 1, 0);
-                insert_text_to_center_of_draft("Exit", 4, 15, 7, 0);
-            }else {
-                insert_text_to_center_of_draft("Main Menu", 9, 13, 7, 0);
-                insert_text_to_center_of_draft("Exit", 4, 15, 1, 0);
+            if (menu_redraw && gameState == InGameWon){
+                menu_redraw = 0;
+                refill_display_draft(menu_game_won, 14);
+                // Inserts the points the player scored
+                insert_text_to_center_of_draft("Points:", 7, 11, 15, -6);
+                insert_player_score_to_draft(11, center_text_in_screen(5) - 5, 15);
+                insert_menu_buttons_to_draft("Main Menu", 9);
+                menu_publish_pending = 1;
             }
 
-            save_display_draft();
+            updater_publish_menu();
         }
+
+        // When to wake up next
+        if (gameState == InGame && game_init) update_clock_deadline(updater_ticks_until_next_event());
+        else set_clock_deadline();
     }
 }
 
@@ -1864,7 +3825,7 @@ void manager(){
     int last_min = 0;
 
     while (TRUE){
-        receive();
+        receive_ticks();
         // Checks if the game state changed
         if (prev_game_state != gameState){
             // if the game state changed to in game (want to play)
@@ -1891,13 +3852,13 @@ void manager(){
             if (mario_got_to_princess){
                 mario_got_to_princess = 0;
                 // if there are any more levels
-                if (game_level + 1 <= 3){
+                if (game_level < levels_count){
+                    // Next LEVEL!!
+                    game_level++;
                     // Init the level vars
                     init_vars_level();
                     // Add points for winning the level
                     add_score_points(POINTS_LEVEL_WON);
-                    // Next LEVEL!!
-                    game_level++;
                     // The clock is resetted to 0:0 so the last minute needs to be 0
                     last_min = 0;
                     send_sound(SOUND_NEW_LEVEL_FREQ);
@@ -1907,8 +3868,8 @@ void manager(){
                 }
             }
 
-            // if it's the second level and a minute has passed we need to speed up the barrel spawn
-            if (game_level >= 2 && last_min != clock_minutes){
+            // if the barrels of the level speed up and a minute has passed we need to speed up the barrel spawn
+            if ((current_level->flags & LEVEL_BARRELS_SPEED_UP) && last_min != clock_minutes){
                 spawn_barrel_speed_in_ticks /= 2;
             }
 
@@ -1959,14 +3920,63 @@ void start_processes(){
     schedule(3, DEFAULT_CYCLE_LENGTH, draw_pid, CYCLE_DRAWER, up_pid, CYCLE_UPDATER, mang_pid, CYCLE_MANAGER);
 }
 
+#ifdef KONG_HEADLESS
+// Runs the game without XINU and without the screen, to time the frame pipeline on the host
+// every frame is a tick of the game, the updater draws it and the drawer prints it to the memory screen
+// Usage: kong [frames]
+int main(int argc, char** argv){
+    int i = 0;
+    int frames = 1000;
+    // How many cells all the frames wrote
+    long cells_written = 0;
+    clock_t start;
+    double seconds;
+
+    if (argc > 1) frames = atoi(argv[1]);
+
+    mark_all_pages_dirty();
+    compile_sprites();
+    load_levels();
+
+    change_game_state(InGame);
+    init_game();
+
+    start = clock();
+    for (i = 0; i < frames; i++){
+        elapsed_time++;
+        updater_game_frame();
+        drawer_print_frame();
+        cells_written += cells_written_last_frame;
+    }
+    seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+    printf("%s: %d frames printed, %ld cells written (%ld a frame), %.3f ms a frame\n",
+    render_backend->name, frames_printed, cells_written, cells_written / frames, seconds * 1000 / frames);
+
+    return 0;
+}
+#else
 xmain(){
     // Saves the color byte
     save_out_to_screen();
 
+    // We dont know what is on the screen pages yet, so the first frames are printed whole
+    mark_all_pages_dirty();
+
+    // Compiles the models of the game to sprites
+    compile_sprites();
+
+    // The level pack or the built in levels
+    load_levels();
+
     // Changes routine #9 to ours
     set_int9();
 
+    // Speeds up the PIT for the game
+    set_game_clock();
+
     start_processes();
 
     return;
 }
+#endif
@@ -16,23 +16,161 @@ extern int gno_of_pids;
 // The id of the time handler process
 extern time_handler_pid;
 
-// Total ticks that has passed since the start
-int elapsed_time = 0;
+// Total ticks that has passed since the start (wraps around)
+unsigned int elapsed_time = 0;
 
-SYSCALL noresched_send(pid, msg)
+// The game can run the PIT faster than the 18.2 Hz of the BIOS
+// every clock_divisor interrupts are one tick of XINU (tod, sleep and preemption)
+int clock_divisor = 1;
+// The interrupts since the last tick of XINU
+int clock_divisor_count = 0;
+// The ticks of XINU since the game clock was set
+long clock_base_ticks = 0;
+
+// Tickless mode: the PIT is set in one shot (mode 0) to the next deadline, instead of every tick
+int clock_tickless = 0;
+// In how many ticks the game needs to run next, 0 = nothing is due (the shot waits for the tick of XINU)
+int clock_deadline_ticks = 0;
+// How many ticks the current shot is
+int clock_shot_ticks = 1;
+
+// The ticks every process got and did not take yet (a counting mailbox, so no tick is lost)
+int pending_ticks[NPROC];
+// Ticks that came while the process still had an unread tick (they were added to it's count)
+long clock_ticks_coalesced = 0;
+// Ticks that could not be sent at all (the process is gone)
+long clock_ticks_dropped = 0;
+
+/*------------------------------------------------------------------------
+ *  read_clock_count  --  latches and reads the count of channel 0 of the PIT
+ *  fired is set if the shot got to 0 (the OUT pin goes up in mode 0)
+ *------------------------------------------------------------------------
+ */
+unsigned int read_clock_count(fired)
+int	*fired;
+{
+	unsigned int count;
+	unsigned char status;
+
+	// Read-back: latch the status and the count of channel 0
+	asm{
+		MOV AL, 0C2H
+		OUT 43H, AL
+		IN AL, 40H
+		MOV status, AL
+		IN AL, 40H
+		MOV AH, AL
+		IN AL, 40H
+		XCHG AH, AL
+		MOV WORD PTR count, AX
+	}
+
+	// Bit 7 of the status is the OUT pin
+	*fired = (status & 0x80) != 0;
+	return count;
+} // read_clock_count
+
+/*------------------------------------------------------------------------
+ *  set_clock_count  --  starts a shot of count (0 = 65536) on channel 0 of the PIT
+ *------------------------------------------------------------------------
+ */
+void set_clock_count(count)
+unsigned int count;
+{
+	// Channel 0, low byte and than high byte, mode 0 (one shot)
+	asm{
+		MOV AL, 30H
+		OUT 43H, AL
+		MOV AX, WORD PTR count
+		OUT 40H, AL
+		MOV AL, AH
+		OUT 40H, AL
+	}
+} // set_clock_count
+
+/*------------------------------------------------------------------------
+ *  program_clock_shot  --  sets the PIT to interrupt at the next deadline
+ *  never later than the next tick of XINU, so tod, sleep and preemption stay right
+ *  late is how long ago the last shot fired (in counts of the PIT), it's taken off so the clock does not drift
+ *------------------------------------------------------------------------
+ */
+void program_clock_shot(late)
+unsigned int late;
+{
+	long count;
+
+	clock_shot_ticks = clock_divisor - clock_divisor_count;
+	if (clock_deadline_ticks > 0 && clock_deadline_ticks < clock_shot_ticks)
+		clock_shot_ticks = clock_deadline_ticks;
+
+	// A whole tick of XINU is 65536 (written as 0)
+	count = clock_shot_ticks * (0x10000L / clock_divisor) - late;
+	// Already too late for this shot, it fires right away
+	if (count < 1)
+		count = 1;
+
+	set_clock_count((unsigned int)count);
+} // program_clock_shot
+
+/*------------------------------------------------------------------------
+ *  rearm_clock_shot  --  cuts the running shot if the deadline is closer than it's end
+ *  the shot ends with the tick of the game it's in, the ticks that passed in it still count
+ *------------------------------------------------------------------------
+ */
+void rearm_clock_shot()
+{
+	long	tick_count;		/* PIT counts in a tick of the game */
+	long	left;			/* PIT counts left in the shot	*/
+	int	ticks_left;
+	int	fired;
+
+	if (!clock_tickless || clock_deadline_ticks <= 0)
+		return;
+
+	left = read_clock_count(&fired);
+	// clkint sets the next shot
+	if (fired)
+		return;
+	if (left == 0)
+		left = 0x10000L;
+
+	tick_count = 0x10000L / clock_divisor;
+	ticks_left = (int)((left + tick_count - 1) / tick_count);
+	if (ticks_left <= clock_deadline_ticks)
+		return;
+
+	// The ticks after the one that is running now are cut
+	clock_shot_ticks -= ticks_left - 1;
+	set_clock_count((unsigned int)(left - (ticks_left - 1) * tick_count));
+} // rearm_clock_shot
+
+/*------------------------------------------------------------------------
+ *  noresched_send_ticks  --  sends ticks to a process without losing them
+ *  if the process did not read the last msg yet, the ticks are added to it's count
+ *------------------------------------------------------------------------
+ */
+SYSCALL noresched_send_ticks(pid, msg, ticks)
 int	pid;
 int	msg;
+int	ticks;
 {
 	struct	pentry	*pptr;		/* receiver's proc. table addr.	*/
 	int	ps;
 
 	disable(ps);
 
-	if (isbadpid(pid) || ( (pptr = &proctab[pid])->pstate == PRFREE)
-	   || pptr->phasmsg != 0) {
+	if (isbadpid(pid) || (pptr = &proctab[pid])->pstate == PRFREE) {
+		clock_ticks_dropped += ticks;
 		restore(ps);
 		return(SYSERR);
 	}
+	pending_ticks[pid] += ticks;
+	// The process will get these ticks with the ones it did not read yet
+	if (pptr->phasmsg != 0) {
+		clock_ticks_coalesced += ticks;
+		restore(ps);
+		return(OK);
+	}
 	pptr->pmsg = msg;		/* deposit message		*/
 	pptr->phasmsg++;
 	if (pptr->pstate == PRRECV) {	/* if receiver waits, start it	*/
@@ -40,7 +178,7 @@ int	msg;
 	}
 	restore(ps);
 	return(OK);
-} // noresched_send
+} // noresched_send_ticks
 
 
 
@@ -54,24 +192,59 @@ int mdevno;				/* minor device number		*/
 {
 	int	i;
         int resched_flag;
+	// How many ticks passed since the last interrupt
+	int	ticks = 1;
+	// Is it a tick of XINU
+	int	xinu_tick = 0;
+	// How long ago the shot fired (in counts of the PIT)
+	unsigned int late = 0;
+	unsigned int count;
+	int	fired;
+
+	if (clock_tickless)
+	{
+		ticks = clock_shot_ticks;
+		// In mode 0 the count goes on down after 0
+		count = read_clock_count(&fired);
+		if (fired)
+			late = 0 - count;
+	}
+
+	// Only every clock_divisor ticks is a tick of XINU
+	clock_divisor_count += ticks;
+	if (clock_divisor_count >= clock_divisor)
+	{
+		clock_divisor_count = 0;
+		xinu_tick = 1;
+	}
+
+	// The next shot first thing (the PIT stops after a shot in mode 0)
+	if (clock_tickless)
+		program_clock_shot(late);
 
     // Used to track the time :)
-	elapsed_time++;
+	elapsed_time += ticks;
 	// Sending a msg to the process that handles the time in the game
-	noresched_send(time_handler_pid, "Tick");
-
-	tod++;
+	noresched_send_ticks(time_handler_pid, "Tick", ticks);
 
         resched_flag = 0;
-	if (slnempty)
-		if ( (--*sltop) <= 0 )
-                     {
-                        resched_flag = 1;
-			wakeup();
-                     } /* if */
-
-	if ( (--preempt) <= 0 )
-             resched_flag = 1;
+
+	if (xinu_tick)
+	{
+		clock_base_ticks++;
+
+		tod++;
+
+		if (slnempty)
+			if ( (--*sltop) <= 0 )
+                     	{
+                        	resched_flag = 1;
+				wakeup();
+                     	} /* if */
+
+		if ( (--preempt) <= 0 )
+             		resched_flag = 1;
+	} /* if */
 
        point_in_cycle++;
        if (point_in_cycle == gcycle_length)
@@ -81,7 +254,7 @@ int mdevno;				/* minor device number		*/
        {
           if(point_in_cycle == sched_arr_int[i])
             {
-             noresched_send(sched_arr_pid[i], 11);
+             noresched_send_ticks(sched_arr_pid[i], 11, ticks);
              resched_flag = 1;
             } // if
        } // for
@@ -0,0 +1,66 @@
+/* headless.h - what Kong.c needs from XINU and clkint.c, for the headless build */
+
+// Kong.c is built with KONG_HEADLESS defined on a normal host (gcc, no XINU and no DOS):
+//     gcc -DKONG_HEADLESS -o kong Kong.c
+// The frames are printed to the memory screen and the hardware code (asm) is left out
+// there are no processes, main() runs the updater and the drawer one after the other (see README)
+
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* XINU */
+#define SYSCALL int
+#define INTPROC int
+#define TRUE 1
+#define FALSE 0
+#define OK 1
+#define SYSERR -1
+#define INITSTK 1024
+#define INITPRIO 20
+
+// There are no interrupts, nothing to disable
+#define disable(ps) ((ps) = 0)
+#define restore(ps) ((void) (ps))
+
+// No segments on the host
+#define far
+
+struct intmap{
+    int ivec;
+    int (*newisr)();
+};
+
+struct intmap* sys_imp = NULL;
+
+// There are no processes, so there is no one to send to or to wait for
+int create(){ return SYSERR; }
+int resume(int pid){ return SYSERR; }
+int receive(){ return 0; }
+int send(int pid, int msg){ return SYSERR; }
+int sleept(int ticks){ return OK; }
+int getpid(){ return 0; }
+
+/* BIOS */
+long biostime(int cmd, long newtime){ return 0; }
+
+/* clkint.c */
+unsigned int elapsed_time = 0;
+int clock_divisor = 1;
+int clock_divisor_count = 0;
+long clock_base_ticks = 0;
+int clock_tickless = 0;
+int clock_deadline_ticks = 0;
+int pending_ticks[1];
+long clock_ticks_dropped = 0;
+
+void program_clock_shot(unsigned int late){
+}
+
+void rearm_clock_shot(){
+}
+
+#endif
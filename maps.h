@@ -3,206 +3,219 @@
 #define SCREEN_WIDTH 80
 #define SCREEN_SIZE SCREEN_HEIGHT*SCREEN_WIDTH
 
-char menu[SCREEN_HEIGHT][SCREEN_WIDTH] = 
+// The screens are packed row by row (they are unpacked by unpack_screen when they are needed)
+// A byte with the high bit (0x80) is a run: the char after it, (byte & 0x7F) times
+// Any other byte is a count of the chars after it, that are copied as they are
+
+const unsigned char menu[] =
 {
-    "--------------------------------------------------------------------------------",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "   DDDDD                  kk                    KK  KK                          ",
-    "   DD  DD   oooo  nn nnn  kk  kk   eee  yy   yy KK KK   oooo  nn nnn   gggggg   ",
-    "   DD   DD oo  oo nnn  nn kkkkk  ee   e yy   yy KKKK   oo  oo nnn  nn gg   gg   ",
-    "   DD   DD oo  oo nn   nn kk kk  eeeee   yyyyyy KK KK  oo  oo nn   nn ggggggg   ",
-    "   DDDDDD   oooo  nn   nn kk  kk  eeeee      yy KK  KK  oooo  nn   nn      gg   ",
-    "                                          yyyyy                         ggggg   ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "--------------------------------------------------------------------------------",
+    0xD0, '-',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0x83, ' ', 0x85, 'D', 0x92, ' ', 2, 'k', 'k', 0x94, ' ', 6, 'K', 'K', ' ', ' ', 'K', 'K', 0x9A, ' ',
+    0x83, ' ', 6, 'D', 'D', ' ', ' ', 'D', 'D', 0x83, ' ', 0x84, 'o', 5, ' ', ' ', 'n', 'n', ' ', 0x83, 'n', 8, ' ', ' ', 'k', 'k', ' ', ' ', 'k', 'k', 0x83, ' ', 0x83, 'e', 4, ' ', ' ', 'y', 'y', 0x83, ' ', 8, 'y', 'y', ' ', 'K', 'K', ' ', 'K', 'K', 0x83, ' ', 0x84, 'o', 5, ' ', ' ', 'n', 'n', ' ', 0x83, 'n', 0x83, ' ', 0x86, 'g', 0x83, ' ',
+    0x83, ' ', 2, 'D', 'D', 0x83, ' ', 10, 'D', 'D', ' ', 'o', 'o', ' ', ' ', 'o', 'o', ' ', 0x83, 'n', 5, ' ', ' ', 'n', 'n', ' ', 0x85, 'k', 4, ' ', ' ', 'e', 'e', 0x83, ' ', 4, 'e', ' ', 'y', 'y', 0x83, ' ', 3, 'y', 'y', ' ', 0x84, 'K', 0x83, ' ', 7, 'o', 'o', ' ', ' ', 'o', 'o', ' ', 0x83, 'n', 7, ' ', ' ', 'n', 'n', ' ', 'g', 'g', 0x83, ' ', 2, 'g', 'g', 0x83, ' ',
+    0x83, ' ', 2, 'D', 'D', 0x83, ' ', 12, 'D', 'D', ' ', 'o', 'o', ' ', ' ', 'o', 'o', ' ', 'n', 'n', 0x83, ' ', 10, 'n', 'n', ' ', 'k', 'k', ' ', 'k', 'k', ' ', ' ', 0x85, 'e', 0x83, ' ', 0x86, 'y', 17, ' ', 'K', 'K', ' ', 'K', 'K', ' ', ' ', 'o', 'o', ' ', ' ', 'o', 'o', ' ', 'n', 'n', 0x83, ' ', 3, 'n', 'n', ' ', 0x87, 'g', 0x83, ' ',
+    0x83, ' ', 0x86, 'D', 0x83, ' ', 0x84, 'o', 4, ' ', ' ', 'n', 'n', 0x83, ' ', 11, 'n', 'n', ' ', 'k', 'k', ' ', ' ', 'k', 'k', ' ', ' ', 0x85, 'e', 0x86, ' ', 11, 'y', 'y', ' ', 'K', 'K', ' ', ' ', 'K', 'K', ' ', ' ', 0x84, 'o', 4, ' ', ' ', 'n', 'n', 0x83, ' ', 2, 'n', 'n', 0x86, ' ', 2, 'g', 'g', 0x83, ' ',
+    0xAA, ' ', 0x85, 'y', 0x99, ' ', 0x85, 'g', 0x83, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, '-'
 };
 
-char menu_game_over[SCREEN_HEIGHT][SCREEN_WIDTH] = 
+const unsigned char menu_game_over[] =
 {
-    "--------------------------------------------------------------------------------",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "         GGGG                              OOOOO                                ",
-    "        GG  GG   aa aa mm mm mmmm    eee  OO   OO vv   vv   eee  rr rr          ",
-    "       GG       aa aaa mmm  mm  mm ee   e OO   OO  vv vv  ee   e rrr  r         ",
-    "       GG   GG aa  aaa mmm  mm  mm eeeee  OO   OO   vvv   eeeee  rr             ",
-    "        GGGGGG  aaa aa mmm  mm  mm  eeeee  OOOO0     v     eeeee rr             ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "--------------------------------------------------------------------------------",
+    0xD0, '-',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0x89, ' ', 0x84, 'G', 0x9E, ' ', 0x85, 'O', 0xA0, ' ',
+    0x88, ' ', 6, 'G', 'G', ' ', ' ', 'G', 'G', 0x83, ' ', 12, 'a', 'a', ' ', 'a', 'a', ' ', 'm', 'm', ' ', 'm', 'm', ' ', 0x84, 'm', 0x84, ' ', 0x83, 'e', 4, ' ', ' ', 'O', 'O', 0x83, ' ', 5, 'O', 'O', ' ', 'v', 'v', 0x83, ' ', 2, 'v', 'v', 0x83, ' ', 0x83, 'e', 7, ' ', ' ', 'r', 'r', ' ', 'r', 'r', 0x8A, ' ',
+    0x87, ' ', 2, 'G', 'G', 0x87, ' ', 3, 'a', 'a', ' ', 0x83, 'a', 1, ' ', 0x83, 'm', 11, ' ', ' ', 'm', 'm', ' ', ' ', 'm', 'm', ' ', 'e', 'e', 0x83, ' ', 4, 'e', ' ', 'O', 'O', 0x83, ' ', 13, 'O', 'O', ' ', ' ', 'v', 'v', ' ', 'v', 'v', ' ', ' ', 'e', 'e', 0x83, ' ', 2, 'e', ' ', 0x83, 'r', 3, ' ', ' ', 'r', 0x89, ' ',
+    0x87, ' ', 2, 'G', 'G', 0x83, ' ', 7, 'G', 'G', ' ', 'a', 'a', ' ', ' ', 0x83, 'a', 1, ' ', 0x83, 'm', 9, ' ', ' ', 'm', 'm', ' ', ' ', 'm', 'm', ' ', 0x85, 'e', 4, ' ', ' ', 'O', 'O', 0x83, ' ', 2, 'O', 'O', 0x83, ' ', 0x83, 'v', 0x83, ' ', 0x85, 'e', 4, ' ', ' ', 'r', 'r', 0x8D, ' ',
+    0x88, ' ', 0x86, 'G', 2, ' ', ' ', 0x83, 'a', 4, ' ', 'a', 'a', ' ', 0x83, 'm', 10, ' ', ' ', 'm', 'm', ' ', ' ', 'm', 'm', ' ', ' ', 0x85, 'e', 2, ' ', ' ', 0x84, 'O', 1, '0', 0x85, ' ', 1, 'v', 0x85, ' ', 0x85, 'e', 3, ' ', 'r', 'r', 0x8D, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, '-'
 };
 
-char menu_game_won[SCREEN_HEIGHT][SCREEN_WIDTH] = 
+const unsigned char menu_game_won[] =
 {
-    "--------------------------------------------------------------------------------",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                         W     W                                                ",
-    "                         W     W ii                                             ",
-    "                         W  W  W    nnn  nnn  eee rrr                           ",
-    "                          W W W  ii n  n n  n e e r                             ",
-    "                           W W   ii n  n n  n ee  r                             ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "--------------------------------------------------------------------------------",
+    0xD0, '-',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0x99, ' ', 1, 'W', 0x85, ' ', 1, 'W', 0xB0, ' ',
+    0x99, ' ', 1, 'W', 0x85, ' ', 4, 'W', ' ', 'i', 'i', 0xAD, ' ',
+    0x99, ' ', 7, 'W', ' ', ' ', 'W', ' ', ' ', 'W', 0x84, ' ', 0x83, 'n', 2, ' ', ' ', 0x83, 'n', 2, ' ', ' ', 0x83, 'e', 1, ' ', 0x83, 'r', 0x9B, ' ',
+    0x9A, ' ', 25, 'W', ' ', 'W', ' ', 'W', ' ', ' ', 'i', 'i', ' ', 'n', ' ', ' ', 'n', ' ', 'n', ' ', ' ', 'n', ' ', 'e', ' ', 'e', ' ', 'r', 0x9D, ' ',
+    0x9B, ' ', 3, 'W', ' ', 'W', 0x83, ' ', 18, 'i', 'i', ' ', 'n', ' ', ' ', 'n', ' ', 'n', ' ', ' ', 'n', ' ', 'e', 'e', ' ', ' ', 'r', 0x9D, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, '-'
 };
 
-char map_1[SCREEN_HEIGHT][SCREEN_WIDTH] = 
+const unsigned char map_1[] =
 {
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                   ______                                       ",
-    "                                   zZzZzZ                                       ",
-    "                                                                                ",
-    "                                                                                ",
-    "           ___________________________________________                          ",
-    "           zZzZzZzZzZzZzZzZzZzZzZzZzZzZzZzZzZzZzZzZzZz                          ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                          _________________________________                     ",
-    "                          ZzZzZzZzZzZzZzZzZzZzZzZzZzZzZzZzZ                     ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                     _________________________________                          ",
-    "                     zZzZzZzZzZzZzZzZzZzZzZzZzZzZzZzZz                          ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                     ______________________________________                     ",
-    "                     zZzZzZzZzZzZzZzZzZzZzZzZzZzZzZzZzZzZzZ                     ",
-    "                                                                                ",
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xA3, ' ', 0x86, '_', 0xA7, ' ',
+    0xA3, ' ', 6, 'z', 'Z', 'z', 'Z', 'z', 'Z', 0xA7, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0x8B, ' ', 0xAB, '_', 0x9A, ' ',
+    0x8B, ' ', 43, 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 0x9A, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0x9A, ' ', 0xA1, '_', 0x95, ' ',
+    0x9A, ' ', 33, 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 0x95, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0x95, ' ', 0xA1, '_', 0x9A, ' ',
+    0x95, ' ', 33, 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 0x9A, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0xD0, ' ',
+    0x95, ' ', 0xA6, '_', 0x95, ' ',
+    0x95, ' ', 38, 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 'z', 'Z', 0x95, ' ',
+    0xD0, ' '
 };
 
-char ladders_level_1[SCREEN_HEIGHT][SCREEN_WIDTH] = 
+// A ladder of a level, a "|_|" that starts at (x,y) and goes height rows down
+typedef struct LadderSegment{
+    int x;
+    int y;
+    int height;
+} ladderSegment;
+
+const ladderSegment ladders_level_1[] =
 {
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                |_|                                             ",
-    "                                |_|    |_|                                      ",
-    "                                |_|    |_|                                      ",
-    "                                |_|    |_|                                      ",
-    "                                |_|    |_|                                      ",
-    "                                           |_|     |_|                          ",
-    "                                           |_|     |_|                          ",
-    "                                           |_|     |_|                          ",
-    "                                           |_|     |_|                          ",
-    "                                           |_|     |_|                          ",
-    "                          |_|     |_|                                           ",
-    "                          |_|     |_|                                           ",
-    "                          |_|     |_|                                           ",
-    "                          |_|     |_|                                           ",
-    "                          |_|     |_|                                           ",
-    "                                                  |_|                           ",
-    "                                                  |_|                           ",
-    "                                                  |_|                           ",
-    "                                                  |_|                           ",
-    "                                                  |_|                           ",
-    "                                                                                ",
-    "                                                                                ",
+    {32, 3, 5},
+    {39, 4, 4},
+    {43, 8, 5},
+    {51, 8, 5},
+    {26, 13, 5},
+    {34, 13, 5},
+    {50, 18, 5}
 };
 
-char ladders_level_2[SCREEN_HEIGHT][SCREEN_WIDTH] = 
+const ladderSegment ladders_level_2[] =
 {
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                       |_|                                      ",
-    "                                       |_|                                      ",
-    "                                       |_|                                      ",
-    "                                       |_|                                      ",
-    "                               |_|                                              ",
-    "                               |_|                                              ",
-    "                               |_|                                              ",
-    "                               |_|                                              ",
-    "                               |_|                                              ",
-    "                                  |_|              |_|                          ",
-    "                                  |_|              |_|                          ",
-    "                                  |_|              |_|                          ",
-    "                                  |_|              |_|                          ",
-    "                                  |_|              |_|                          ",
-    "                           |_|                                                  ",
-    "                           |_|                                                  ",
-    "                           |_|                                                  ",
-    "                           |_|                                                  ",
-    "                           |_|                                                  ",
-    "                                                                                ",
-    "                                                                                ",
+    {39, 4, 4},
+    {31, 8, 5},
+    {34, 13, 5},
+    {51, 13, 5},
+    {27, 18, 5}
 };
 
-char ladders_level_3[SCREEN_HEIGHT][SCREEN_WIDTH] = 
+const ladderSegment ladders_level_3[] =
 {
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                                                                ",
-    "                                       |_|                                      ",
-    "                                       |_|                                      ",
-    "                                       |_|                                      ",
-    "                                       |_|                                      ",
-    "                               |_|                                              ",
-    "                               |_|                                              ",
-    "                               |_|                                              ",
-    "                               |_|                                              ",
-    "                               |_|                                              ",
-    "                                                   |_|                          ",
-    "                                                   |_|                          ",
-    "                                                   |_|                          ",
-    "                                                   |_|                          ",
-    "                                                   |_|                          ",
-    "                           |_|                                                  ",
-    "                           |_|                                                  ",
-    "                           |_|                                                  ",
-    "                           |_|                                                  ",
-    "                           |_|                                                  ",
-    "                                                                                ",
-    "                                                                                ",
+    {39, 4, 4},
+    {31, 8, 5},
+    {51, 13, 5},
+    {27, 18, 5}
 };
 
+// A platform the hammer can be spawned on, somewhere in [x_min, x_max) of the row y
+typedef struct HammerPlatform{
+    int x_min;
+    int x_max;
+    int y;
+} hammerPlatform;
+
+const hammerPlatform hammer_platforms_level_1[] =
+{
+    {22, 57, 22},
+    {22, 53, 17},
+    {28, 57, 12}
+};
+
+// The flags of a level
+// Falling barrels = kong throws falling barrels too, Barrels speed up = kong throws barrels faster every minute
+#define LEVEL_FALLING_BARRELS 1
+#define LEVEL_BARRELS_SPEED_UP 2
+
+// Everything that makes a level
+// The built in levels are here, the levels can be replaced by the level pack (see load_levels in Kong.c)
+typedef struct LevelInfo{
+    // The map of the level, packed like the screens
+    const unsigned char* packed_map;
+    // The ladders of the level
+    const ladderSegment* ladders;
+    int ladders_count;
+    // Where the hammer can be spawned
+    const hammerPlatform* hammer_platforms;
+    int hammer_platforms_count;
+
+    // Where the player starts, kong and the princess are (top left)
+    int player_start_x;
+    int player_start_y;
+    int kong_x;
+    int kong_y;
+    int princess_x;
+    int princess_y;
+
+    // The timings of the level (in ticks)
+    int spawn_barrel_speed_in_ticks;
+    int spawn_falling_barrel_speed_in_ticks;
+    int barrel_movement_speed_in_ticks;
+    int apply_gravity_every_ticks;
+
+    // LEVEL_... flags
+    int flags;
+} levelInfo;
+
+const levelInfo builtin_levels[] =
+{
+    {map_1, ladders_level_1, sizeof(ladders_level_1) / sizeof(ladderSegment),
+    hammer_platforms_level_1, sizeof(hammer_platforms_level_1) / sizeof(hammerPlatform),
+    40, 20, 22, 5, 35, 2, 6 * 18, 4 * 18, 5, 5, 0},
+    {map_1, ladders_level_2, sizeof(ladders_level_2) / sizeof(ladderSegment),
+    hammer_platforms_level_1, sizeof(hammer_platforms_level_1) / sizeof(hammerPlatform),
+    40, 20, 22, 5, 35, 2, 6 * 18, 4 * 18, 5, 5, LEVEL_FALLING_BARRELS | LEVEL_BARRELS_SPEED_UP},
+    {map_1, ladders_level_3, sizeof(ladders_level_3) / sizeof(ladderSegment),
+    hammer_platforms_level_1, sizeof(hammer_platforms_level_1) / sizeof(hammerPlatform),
+    40, 20, 22, 5, 35, 2, 6 * 18, 4 * 18, 5, 5, LEVEL_FALLING_BARRELS | LEVEL_BARRELS_SPEED_UP}
+};